@@ -0,0 +1,146 @@
+// Run the tool once over a generated corpus and report throughput:
+//   bench LABEL CORPUS OUTDIR TOOL [TOOL ARGS...]
+// The objects are renamed into OUTDIR (--output-dir) with CORPUS/rules.txt
+// so the corpus can be reused.  The MB read and written are the tool's own
+// counts from --stats: the bytes it read, mapped or copied in and the bytes
+// it wrote back, whatever --io it used.  "ms lookup" is the time spent
+// in checkIfSymbolsExist, which hashes every symbol name and looks it up
+// in the rules, summed over the workers.  Peak RSS comes from wait4().
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static int compareNames(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Objects of 'dir' (obj*.o), sorted
+static char **listObjects(const char *dir, int *count) {
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  char **list = NULL;
+  int cap = 0;
+  *count = 0;
+  if (d == NULL) {
+    perror(dir);
+    exit(1);
+  }
+  while ((de = readdir(d)) != NULL) {
+    size_t len = strlen(de->d_name);
+    if (strncmp(de->d_name, "obj", 3) != 0 || len < 3 ||
+        strcmp(de->d_name + len - 2, ".o") != 0)
+      continue;
+    if (*count == cap) {
+      cap = cap ? cap * 2 : 256;
+      list = realloc(list, cap * sizeof(char *));
+    }
+    list[*count] = malloc(strlen(dir) + len + 2);
+    sprintf(list[*count], "%s/%s", dir, de->d_name);
+    (*count)++;
+  }
+  closedir(d);
+  qsort(list, *count, sizeof(char *), compareNames);
+  return list;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 5) {
+    fprintf(stderr, "Usage: bench LABEL CORPUS OUTDIR TOOL [ARGS...]\n");
+    return 1;
+  }
+  const char *label = argv[1], *corpus = argv[2], *outdir = argv[3];
+  int nobj;
+  char **objs = listObjects(corpus, &nobj);
+  char rules[4096], outarg[4096];
+  snprintf(rules, sizeof(rules), "--rules=%s/rules.txt", corpus);
+  snprintf(outarg, sizeof(outarg), "--output-dir=%s", outdir);
+  mkdir(outdir, 0755);
+
+  // TOOL ARGS... --stats --rules --output-dir -o objects...
+  int extra = argc - 4;
+  char **args = calloc(extra + 4 + nobj + 1, sizeof(char *));
+  int n = 0;
+  for (int i = 0; i < extra; ++i)
+    args[n++] = argv[4 + i];
+  args[n++] = "--stats";
+  args[n++] = rules;
+  args[n++] = outarg;
+  args[n++] = "-o";
+  for (int i = 0; i < nobj; ++i)
+    args[n++] = objs[i];
+
+  int fds[2];
+  if (pipe(fds) == -1) {
+    perror("pipe");
+    return 1;
+  }
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(fds[1], 1);
+    close(fds[0]);
+    close(fds[1]);
+    execv(args[0], args);
+    perror(args[0]);
+    _exit(127);
+  }
+  close(fds[1]);
+
+  // Keep only the tool's summary line and the I/O of the phases that
+  // cover everything: each object's processObject and the commits
+  FILE *fp = fdopen(fds[0], "r");
+  char *line = NULL;
+  size_t cap = 0;
+  int done = 0;
+  long renamed = 0;
+  double readKB = 0, writtenKB = 0, lookupMs = 0;
+  while (getline(&line, &cap, fp) != -1) {
+    char phase[64];
+    double ms, r, w;
+    if (strncmp(line, "Summary: ", 9) == 0) {
+      sscanf(line + 9, "%d object(s), %ld symbol(s)", &done, &renamed);
+    } else if (sscanf(line, "%63s %*d %lf %*f %*f %lf %lf", phase, &ms, &r,
+                      &w) == 4) {
+      if (strcmp(phase, "processObject") == 0 ||
+          strcmp(phase, "commit") == 0) {
+        readKB += r;
+        writtenKB += w;
+      } else if (strcmp(phase, "checkIfSymbolsExist") == 0) {
+        lookupMs = ms;
+      }
+    }
+  }
+  fclose(fp);
+  free(line);
+
+  int status;
+  struct rusage ru;
+  if (wait4(pid, &status, 0, &ru) == -1) {
+    perror("wait4");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s: the tool failed\n", label);
+    return 1;
+  }
+
+  printf("%-10s %6d objects %8.3f s %9.0f objects/s %11.0f symbols/s "
+         "%8.1f ms lookup %8.1f MB read %8.1f MB written %7.1f MB peak "
+         "RSS\n",
+         label, done, secs, done / secs, renamed / secs, lookupMs,
+         readKB / 1024.0, writtenKB / 1024.0, ru.ru_maxrss / 1024.0);
+  for (int i = 0; i < nobj; ++i)
+    free(objs[i]);
+  free(objs);
+  free(args);
+  return 0;
+}
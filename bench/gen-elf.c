@@ -0,0 +1,137 @@
+// Synthetic ELF corpus for the benchmark: N objects of one kind
+// (ET_REL or ET_EXEC, ELFCLASS32 or ELFCLASS64) with a configurable number
+// of symbols, name length, extra sections and debug section size, plus a
+// rules file renaming every other symbol.
+#include <elf.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  int objects;
+  int symbols;
+  int nameLen;
+  int sections;
+  size_t debugSize;
+  int elfclass; // 32 or 64
+  int exec;
+} GenConfig;
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} Buf;
+
+// Append 'len' bytes, returning the offset they were put at
+static size_t buf_append(Buf *b, const char *data, size_t len) {
+  if (b->len + len > b->cap) {
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + len)
+      cap *= 2;
+    b->data = realloc(b->data, cap);
+    if (b->data == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+    b->cap = cap;
+  }
+  size_t off = b->len;
+  if (data)
+    memcpy(b->data + off, data, len);
+  else
+    memset(b->data + off, 0, len);
+  b->len += len;
+  return off;
+}
+
+static void buf_zero(Buf *b, size_t len) { buf_append(b, NULL, len); }
+
+static void buf_align(Buf *b, size_t align) {
+  if (align > 1 && b->len % align)
+    buf_zero(b, align - b->len % align);
+}
+
+static int buf_write(Buf *b, const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1 || write(fd, b->data, b->len) != (ssize_t)b->len) {
+    perror(path);
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+  return close(fd);
+}
+
+static void symbolName(char *name, int i, int len) {
+  int n = sprintf(name, "s%07d_", i);
+  for (; n < len; ++n)
+    name[n] = 'a' + (i + n) % 26;
+  name[n] = '\0';
+}
+
+#define ELF_N Elf64
+#include "genclass.c"
+#define ELF_N Elf32
+#include "genclass.c"
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: gen-elf -d DIR [-n objects] [-s symbols] [-l name length]\n"
+          "               [-S extra sections] [-g debug bytes] [-c 32|64]\n"
+          "               [-t rel|exec]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  GenConfig cfg = {.objects = 100, .symbols = 200, .nameLen = 24,
+                   .sections = 8, .debugSize = 16384, .elfclass = 64};
+  char *dir = NULL;
+  int c;
+  while ((c = getopt(argc, argv, "d:n:s:l:S:g:c:t:")) != -1) {
+    switch (c) {
+    case 'd': dir = optarg; break;
+    case 'n': cfg.objects = atoi(optarg); break;
+    case 's': cfg.symbols = atoi(optarg); break;
+    case 'l': cfg.nameLen = atoi(optarg); break;
+    case 'S': cfg.sections = atoi(optarg); break;
+    case 'g': cfg.debugSize = strtoul(optarg, NULL, 0); break;
+    case 'c': cfg.elfclass = atoi(optarg); break;
+    case 't': cfg.exec = strcmp(optarg, "exec") == 0; break;
+    default: usage();
+    }
+  }
+  if (dir == NULL || cfg.objects < 1 || cfg.symbols < 1 || cfg.nameLen < 9 ||
+      (cfg.elfclass != 32 && cfg.elfclass != 64))
+    usage();
+  mkdir(dir, 0755);
+
+  char path[4096];
+  for (int i = 0; i < cfg.objects; ++i) {
+    snprintf(path, sizeof(path), "%s/obj%05d.o", dir, i);
+    int rc = cfg.elfclass == 64 ? writeObject_Elf64(path, &cfg, i)
+                                : writeObject_Elf32(path, &cfg, i);
+    if (rc == -1)
+      return 1;
+  }
+
+  snprintf(path, sizeof(path), "%s/rules.txt", dir);
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    perror(path);
+    return 1;
+  }
+  char *name = malloc(cfg.nameLen + 32);
+  for (int i = 0; i < cfg.symbols; i += 2) {
+    symbolName(name, i, cfg.nameLen);
+    fprintf(fp, "append %s _bench\n", name);
+  }
+  free(name);
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,170 @@
+// Included once per ELF class by gen-elf.c, like src/elfops.c
+#define MK_FCN_NAME(name, vers) name ## vers
+#define FUNCTION_NAME(name, vers) MK_FCN_NAME(name, vers)
+
+#define MK_TYPE_NAME(name, vers) vers ## name
+#define TYPE_NAME(name, vers) MK_TYPE_NAME(name, vers)
+#define ElfType_Ehdr TYPE_NAME(_Ehdr, ELF_N)
+#define ElfType_Phdr TYPE_NAME(_Phdr, ELF_N)
+#define ElfType_Shdr TYPE_NAME(_Shdr, ELF_N)
+#define ElfType_Sym  TYPE_NAME(_Sym,  ELF_N)
+
+// One object: .text, .data, extra .rodata.N sections, .debug_info, then
+// .symtab, .strtab, .shstrtab and the section header table.  Executables
+// get two PT_LOADs and addresses; relocatable objects neither.
+int FUNCTION_NAME(writeObject_, ELF_N)(const char *path, const GenConfig *cfg,
+                                       int objnum) {
+  int is64 = sizeof(ElfType_Ehdr) == sizeof(Elf64_Ehdr);
+  int exec = cfg->exec;
+  unsigned long base = exec ? (is64 ? 0x400000UL : 0x8048000UL) : 0;
+  int nsects = 7 + cfg->sections; // null text data rodata.* debug symtab strtab shstrtab
+  int nphdr = exec ? 2 : 0;
+  Buf out = {0}, strtab = {0}, shstrtab = {0};
+  ElfType_Shdr *sh = calloc(nsects + 1, sizeof(ElfType_Shdr));
+  ElfType_Sym *syms = calloc(cfg->symbols + 2, sizeof(ElfType_Sym));
+  char *name = malloc(cfg->nameLen + 32);
+  int s = 0, nsym = 0;
+  if (!sh || !syms || !name)
+    return -1;
+
+  buf_append(&strtab, "", 1);
+  buf_append(&shstrtab, "", 1);
+  buf_zero(&out, sizeof(ElfType_Ehdr) + nphdr * sizeof(ElfType_Phdr));
+
+#define SECTION(nm, type, flags, align)                                        \
+  do {                                                                         \
+    s++;                                                                       \
+    buf_align(&out, align);                                                    \
+    sh[s].sh_name = buf_append(&shstrtab, nm, strlen(nm) + 1);                 \
+    sh[s].sh_type = type;                                                      \
+    sh[s].sh_flags = flags;                                                    \
+    sh[s].sh_addralign = align;                                                \
+    sh[s].sh_offset = out.len;                                                 \
+    if (exec && ((flags) & SHF_ALLOC))                                         \
+      sh[s].sh_addr = base + out.len;                                          \
+  } while (0)
+
+  // .text: a 'ret' per function
+  SECTION(".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16);
+  int text = s;
+  for (int i = 0; i < cfg->symbols; i += 2)
+    buf_append(&out, "\xc3\x90\x90\x90\x90\x90\x90\x90\x90\x90\x90\x90\x90\x90"
+                     "\x90\x90", 16);
+  sh[s].sh_size = out.len - sh[s].sh_offset;
+  size_t text_end = out.len;
+
+  // .data: a word per object
+  if (exec)
+    buf_zero(&out, (4096 - out.len % 4096) % 4096); // own page
+  SECTION(".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 8);
+  int data = s;
+  for (int i = 1; i < cfg->symbols; i += 2) {
+    uint64_t word = objnum * 1000003ULL + i;
+    buf_append(&out, (char *)&word, 8);
+  }
+  sh[s].sh_size = out.len - sh[s].sh_offset;
+
+  for (int k = 0; k < cfg->sections; ++k) {
+    char nm[32];
+    snprintf(nm, sizeof(nm), ".rodata.%d", k);
+    SECTION(nm, SHT_PROGBITS, SHF_ALLOC, 8);
+    for (int b = 0; b < 64; ++b)
+      buf_append(&out, (char *)&b, 1);
+    sh[s].sh_size = out.len - sh[s].sh_offset;
+  }
+  size_t data_end = out.len;
+
+  SECTION(".debug_info", SHT_PROGBITS, 0, 1);
+  for (size_t b = 0; b < cfg->debugSize; ++b) {
+    char c = (char)(b * 31 + objnum);
+    buf_append(&out, &c, 1);
+  }
+  sh[s].sh_size = out.len - sh[s].sh_offset;
+
+  // Symbols: a FILE symbol, then alternating global functions and objects
+  // named sNNNNNNN_ padded to the requested length
+  nsym = 1;
+  syms[nsym].st_name = buf_append(&strtab, "gen.c", 6);
+  syms[nsym].st_info = ELF32_ST_INFO(STB_LOCAL, STT_FILE);
+  syms[nsym].st_shndx = SHN_ABS;
+  nsym++;
+  for (int i = 0; i < cfg->symbols; ++i, ++nsym) {
+    symbolName(name, i, cfg->nameLen);
+    syms[nsym].st_name = buf_append(&strtab, name, strlen(name) + 1);
+    if (i % 2 == 0) {
+      syms[nsym].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+      syms[nsym].st_shndx = text;
+      syms[nsym].st_value = sh[text].sh_addr + (i / 2) * 16;
+      syms[nsym].st_size = 1;
+    } else {
+      syms[nsym].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_OBJECT);
+      syms[nsym].st_shndx = data;
+      syms[nsym].st_value = sh[data].sh_addr + (i / 2) * 8;
+      syms[nsym].st_size = 8;
+    }
+  }
+
+  SECTION(".symtab", SHT_SYMTAB, 0, is64 ? 8 : 4);
+  int symtab = s;
+  buf_append(&out, (char *)syms, nsym * sizeof(ElfType_Sym));
+  sh[s].sh_size = nsym * sizeof(ElfType_Sym);
+  sh[s].sh_entsize = sizeof(ElfType_Sym);
+  sh[s].sh_info = 2; // first global
+  SECTION(".strtab", SHT_STRTAB, 0, 1);
+  sh[symtab].sh_link = s;
+  buf_append(&out, strtab.data, strtab.len);
+  sh[s].sh_size = strtab.len;
+  SECTION(".shstrtab", SHT_STRTAB, 0, 1);
+  int shstrndx = s;
+  buf_append(&out, shstrtab.data, shstrtab.len); // all names are in by now
+  sh[s].sh_size = shstrtab.len;
+#undef SECTION
+
+  buf_align(&out, 8);
+  size_t shoff = out.len;
+  buf_append(&out, (char *)sh, (s + 1) * sizeof(ElfType_Shdr));
+
+  ElfType_Ehdr *ehdr = (ElfType_Ehdr *)out.data;
+  memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = is64 ? ELFCLASS64 : ELFCLASS32;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr->e_type = exec ? ET_EXEC : ET_REL;
+  ehdr->e_machine = is64 ? EM_X86_64 : EM_386;
+  ehdr->e_version = EV_CURRENT;
+  ehdr->e_ehsize = sizeof(ElfType_Ehdr);
+  ehdr->e_shoff = shoff;
+  ehdr->e_shentsize = sizeof(ElfType_Shdr);
+  ehdr->e_shnum = s + 1;
+  ehdr->e_shstrndx = shstrndx;
+  if (exec) {
+    ElfType_Phdr *ph = (ElfType_Phdr *)(out.data + sizeof(ElfType_Ehdr));
+    ehdr->e_entry = sh[text].sh_addr;
+    ehdr->e_phoff = sizeof(ElfType_Ehdr);
+    ehdr->e_phentsize = sizeof(ElfType_Phdr);
+    ehdr->e_phnum = nphdr;
+    ph[0].p_type = PT_LOAD;
+    ph[0].p_flags = PF_R | PF_X;
+    ph[0].p_offset = 0;
+    ph[0].p_vaddr = ph[0].p_paddr = base;
+    ph[0].p_filesz = ph[0].p_memsz = text_end;
+    ph[0].p_align = 4096;
+    ph[1].p_type = PT_LOAD;
+    ph[1].p_flags = PF_R | PF_W;
+    ph[1].p_offset = sh[data].sh_offset;
+    ph[1].p_vaddr = ph[1].p_paddr = base + sh[data].sh_offset;
+    ph[1].p_filesz = ph[1].p_memsz = data_end - sh[data].sh_offset;
+    ph[1].p_align = 4096;
+  }
+
+  int rc = buf_write(&out, path);
+  free(out.data);
+  free(strtab.data);
+  free(shstrtab.data);
+  free(sh);
+  free(syms);
+  free(name);
+  return rc;
+}
+
+#undef ELF_N
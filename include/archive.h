@@ -0,0 +1,35 @@
+#ifndef MOD_ELF_SYMBOL_ARCHIVE_H
+#define MOD_ELF_SYMBOL_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AR_MAGIC "!<arch>\n"
+#define AR_THIN_MAGIC "!<thin>\n"
+#define AR_MAGIC_SIZE 8
+#define AR_HDR_SIZE 60
+
+typedef enum {
+  AR_MEMBER = 0,
+  AR_ARMAP,     // "/" symbol index, 32 bit offsets
+  AR_ARMAP64,   // "/SYM64/" symbol index, 64 bit offsets
+  AR_LONGNAMES  // "//" GNU long name table
+} ARKIND;
+
+// One member of a (GNU or SysV) ar archive, as offsets into the archive
+typedef struct {
+  size_t hdr;  // the 60 byte header
+  size_t data; // the contents
+  size_t size;
+  ARKIND kind;
+  const char *name; // points into the archive, not NUL terminated
+  size_t namelen;
+} ArMember;
+
+int ar_parse(const char *addr, size_t size, ArMember **members, int *count);
+size_t ar_armap_size(int nsyms, size_t names_len, int is64);
+void ar_write_armap(char *buf, size_t bufsize, int nsyms, const uint64_t *offsets,
+                    char **names, int is64);
+void ar_patch_header(char *hdr, size_t size);
+
+#endif // MOD_ELF_SYMBOL_ARCHIVE_H
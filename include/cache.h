@@ -0,0 +1,42 @@
+#ifndef MOD_ELF_SYMBOL_CACHE_H
+#define MOD_ELF_SYMBOL_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Extended attribute left on every object the cache knows about
+#define CACHE_XATTR "user.mod-elf-symbol"
+
+// Processing an object whose contents hash to 'in' with the rules hashing
+// to 'rules' produced an object hashing to 'out'
+typedef struct {
+  uint64_t in;
+  uint64_t rules;
+  uint64_t out;
+} CacheEntry;
+
+// The manifest of an incremental run.  Entries read from the file are
+// searched, entries added by the workers are only written back.
+typedef struct {
+  CacheEntry *entries; // sorted by in, rules
+  CacheEntry *byOut;   // the same, sorted by out, rules
+  size_t count;
+  CacheEntry *added;
+  size_t addedCount;
+  size_t addedCap;
+  pthread_mutex_t lock;
+} Cache;
+
+int cache_load(Cache *cache, const char *path);
+int cache_save(Cache *cache, const char *path);
+const CacheEntry *cache_find_in(const Cache *cache, uint64_t in,
+                                uint64_t rules);
+const CacheEntry *cache_find_out(const Cache *cache, uint64_t out,
+                                 uint64_t rules);
+int cache_add(Cache *cache, uint64_t in, uint64_t rules, uint64_t out);
+void cache_mark(const char *path, uint64_t rules, uint64_t out);
+int cache_marked(const char *path, uint64_t rules, uint64_t *out);
+void cache_free(Cache *cache);
+
+#endif // MOD_ELF_SYMBOL_CACHE_H
@@ -0,0 +1,27 @@
+#ifndef MOD_ELF_SYMBOL_COMMIT_H
+#define MOD_ELF_SYMBOL_COMMIT_H
+
+// A finished result in 'tmp', to be renamed over 'target' in the same
+// directory
+typedef struct {
+  char *tmp;
+  char *target;
+} CommitEntry;
+
+// Results waiting to be committed.  The strings are not copied.
+typedef struct {
+  CommitEntry *entries;
+  int count;
+  int cap;
+  long committed; // totals over every flush
+  long syncs;
+} CommitBatch;
+
+// Results are committed in groups of this many
+#define COMMIT_GROUP 256
+
+int commit_add(CommitBatch *batch, char *tmp, char *target);
+int commit_flush(CommitBatch *batch);
+void commit_free(CommitBatch *batch);
+
+#endif // MOD_ELF_SYMBOL_COMMIT_H
@@ -0,0 +1,34 @@
+#ifndef MOD_ELF_SYMBOL_IORING_H
+#define MOD_ELF_SYMBOL_IORING_H
+
+#include "util.h"
+
+// Read-ahead of the objects of a run.  While one object is being worked
+// on, the next 'depth' objects are fetched in the background:
+//   IORING_URING    opened, stat'ed and read into memory through io_uring,
+//                   and handed over as buffered MappedFiles; writebacks of
+//                   files with mf->ring are submitted through the same ring
+//   IORING_FADVISE  the fallback: their page cache is warmed with
+//                   posix_fadvise(WILLNEED), and they are then mapped as usual
+typedef enum { IORING_OFF = 0, IORING_URING, IORING_FADVISE } IORINGBACKEND;
+
+// Objects read ahead when --io=uring is given without --io-depth
+#define IORING_DEFAULT_DEPTH 16
+
+// Path of object 'item', and whether it is going to be modified in place
+typedef char *(*ioring_file_fn)(int item, void *arg, int *writable);
+
+// Each run has a read-ahead of its own, so runs on different threads do
+// not share anything here
+typedef struct IoRing IoRing;
+
+IoRing *ioring_start(IORINGBACKEND backend, int count, int depth,
+                     ioring_file_fn file, void *arg);
+IORINGBACKEND ioring_backend(const IoRing *r);
+int ioring_take(IoRing *r, int item, MappedFile *mf);
+void ioring_skip(IoRing *r, int item);
+int ioring_write(MappedFile *mf, const Extent *extents, int count,
+                 int *calls);
+void ioring_stop(IoRing *r, long *prefetched, long *calls);
+
+#endif // MOD_ELF_SYMBOL_IORING_H
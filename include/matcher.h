@@ -0,0 +1,49 @@
+#ifndef MOD_ELF_SYMBOL_MATCHER_H
+#define MOD_ELF_SYMBOL_MATCHER_H
+
+#include <stddef.h>
+
+typedef enum {
+  MATCH_EXACT = 0,
+  MATCH_PREFIX,
+  MATCH_SUFFIX,
+  MATCH_GLOB
+} MATCHTYPE;
+
+typedef struct {
+  MATCHTYPE type;
+  const char *pattern;
+  size_t len;    // length of the literal fed to the automaton
+  int id;        // smallest id wins when several patterns match
+  int nextAtNode; // next pattern whose literal ends at the same node
+} MatcherPattern;
+
+// All prefix, suffix and glob patterns compiled into one Aho-Corasick DFA.
+// Prefixes and suffixes are matched by the automaton directly; for a glob
+// its longest literal run is fed to the automaton and fnmatch() only runs
+// on names that contain it.  The DFA runs on byte classes: every byte that
+// appears in a literal has a class of its own, all others share class 0,
+// so a row is as wide as the literals' alphabet (symbol names use fewer
+// than 64 distinct bytes) rather than 256 transitions.
+typedef struct {
+  MatcherPattern *patterns;
+  int count;
+  int cap;
+  int *always; // patterns without any literal: checked on every name
+  int alwaysCount;
+
+  unsigned char classOf[256]; // class of each byte, 0: in no literal
+  int classes;                // classes, the width of a row of 'next'
+  int *next;   // nodes * classes transitions
+  int *out;    // first pattern ending at the node, -1 if none
+  int *dict;   // nearest node on the failure chain with output, -1 if none
+  int nodes;
+  int nodeCap;
+} Matcher;
+
+int matcher_add(Matcher *m, MATCHTYPE type, const char *pattern, int id);
+int matcher_compile(Matcher *m);
+int matcher_match(const Matcher *m, const char *name, size_t maxlen);
+void matcher_free(Matcher *m);
+
+#endif // MOD_ELF_SYMBOL_MATCHER_H
@@ -0,0 +1,176 @@
+#ifndef MODELFSYMBOL_H
+#define MODELFSYMBOL_H
+
+// libmodelfsymbol: rename symbols of ELF objects and static libraries from
+// within another program.  mod-elf-symbol itself is a thin wrapper over it.
+//
+//   MesOptions opts;
+//   mes_options_init(&opts);
+//   opts.jobs = 8;
+//   MesHandle *h;
+//   if (mes_open(&opts, &h) != MES_OK) ...
+//   MesRules *rules = mes_rules_new();
+//   mes_rules_add(rules, MES_APPEND, "foo", "_bar");
+//   mes_run(h, rules, objects, NULL, count, done, arg);
+//   mes_rules_free(rules);
+//   mes_close(h);
+//
+// Nothing here exits or asserts: every failure comes back as a MESERROR,
+// and what went wrong with an object is in its log.  A handle and a rule
+// set are used by one thread at a time; different handles can run at once.
+// Each run has its own read-ahead, and results written aside with
+// commitAtomic get names of their own, so two handles can even work on
+// the same files.  Rule sets are not tied to a handle and can be used
+// again and again.  The one thing shared by the whole process is the
+// phase tracing of mod-elf-symbol's --trace and --stats: the library only
+// records anything while the command line tool has it switched on.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MES_API __attribute__((visibility("default")))
+
+typedef struct MesHandle MesHandle;
+typedef struct MesRules MesRules;
+
+typedef enum {
+  MES_OK = 0,
+  MES_ERR_ARGS,   // an invalid argument, or rules added after their use
+  MES_ERR_NOMEM,  // out of memory
+  MES_ERR_RULES,  // a rule or rules file could not be read
+  MES_ERR_IO,     // an object could not be read or written
+  MES_ERR_FORMAT, // not an ELF object or archive that can be handled
+  MES_ERR_OBJECT, // the rules could not be applied to the object
+  MES_ERR_CACHE,  // the cache manifest could not be read or written
+  MES_ERR_COMMIT  // a result could not be renamed into place
+} MESERROR;
+
+// What happens to a symbol named by a rule: 'str' is appended to it
+// (MES_APPEND), 'str' and the object's position in the run are appended
+// (MES_NUMBER), or it is replaced by 'str' (MES_RENAME).  A NULL 'str'
+// selects the __dmtcp_plt and __dmtcp_ defaults of the first two.
+typedef enum { MES_APPEND = 0, MES_NUMBER, MES_RENAME } MESRULE;
+
+// Pattern rules select symbols by prefix, suffix or glob and append 'str'
+typedef enum {
+  MES_MATCH_PREFIX = 1,
+  MES_MATCH_SUFFIX,
+  MES_MATCH_GLOB
+} MESMATCH;
+
+typedef enum {
+  MES_BOTH_DEF_AND_UNDEF = 0,
+  MES_ONLY_DEF,
+  MES_ONLY_UNDEF
+} MESSELECT;
+
+// How much goes into each object's log.  Errors always do; MES_LOG_INFO
+// adds the report of every object, MES_LOG_VERBOSE the details of each
+// step.  MES_LOG_SUMMARY only matters to the command line tool.
+typedef enum {
+  MES_LOG_QUIET = 0,
+  MES_LOG_SUMMARY,
+  MES_LOG_INFO,
+  MES_LOG_VERBOSE
+} MESLOGLEVEL;
+
+// How objects are read and written back: mapped, read into memory and
+// written back range by range, or that with io_uring read-ahead
+typedef enum { MES_IO_MMAP = 0, MES_IO_BUFFERED, MES_IO_URING } MESIO;
+
+typedef struct {
+  MESSELECT select;
+  int dynamic;           // rename .dynsym even when there is a .symtab
+  int strtabAtEnd;       // move a grown .strtab to the end of the file
+  MESLOGLEVEL logLevel;
+  int jobs;              // objects processed at once
+  MESIO io;
+  int ioDepth;           // objects read ahead, -1 for the default
+  int commitAtomic;      // results are written aside and renamed into place
+  const char *cacheFile; // manifest of processed objects, NULL for none
+  int collectRenames;    // fill in MesResult.renames
+} MesOptions;
+
+// The outcome for one object, handed to the mes_result_fn in the order
+// the objects were given.  'log' is only valid during the callback
+// (mes_process(): until the next run), 'renames' until the next run on
+// the handle.
+typedef struct {
+  const char *path;
+  const char *output; // where the result went, NULL: modified in place
+  MESERROR status;
+  int cached;         // already processed with these rules, left alone
+  int renamed;        // symbols renamed
+  uint64_t bytesAdded; // new string table bytes
+  const char *log;    // what was done, at the handle's log level
+  size_t logLen;
+  const char *const *renames; // old name, new name, old name, ...
+  int renameCount;            // pairs in 'renames'
+} MesResult;
+
+// Returning non-zero stops the run: no further object is started, and an
+// object in progress that has not started writing is left as it was.
+// Those written with commitAtomic are removed without being committed.
+// The others in progress had already changed their target, and are still
+// handed to the callback, in order, before mes_run() returns; what it
+// returns for them is ignored.
+typedef int (*mes_result_fn)(const MesResult *result, int item, void *arg);
+
+// What a run read the next objects ahead with
+typedef enum {
+  MES_READAHEAD_NONE = 0,
+  MES_READAHEAD_URING,
+  MES_READAHEAD_FADVISE // io_uring was not available, or MES_IO_URING was
+                        // not asked for and ioDepth was
+} MESREADAHEAD;
+
+// Totals of the last run on a handle
+typedef struct {
+  int objects;      // reported, fewer than given when the run was stopped
+  int failed;
+  long renamed;
+  long cached;
+  long ioExtents;   // dirty ranges written back
+  long ioCalls;     // and the write calls that took
+  MESREADAHEAD readAhead;
+  int ioDepth;      // objects read ahead at a time
+  long prefetched;  // objects read through io_uring
+  long ringCalls;   // io_uring_enter calls
+  long committed;   // results renamed into place
+  long syncs;       // and the sync calls that took
+  size_t cacheSize; // objects in the manifest
+} MesStats;
+
+MES_API void mes_options_init(MesOptions *opts);
+MES_API const char *mes_strerror(MESERROR err);
+
+MES_API MesRules *mes_rules_new(void);
+MES_API MESERROR mes_rules_add(MesRules *rules, MESRULE kind,
+                               const char *symbol, const char *str);
+MES_API MESERROR mes_rules_add_pattern(MesRules *rules, MESMATCH match,
+                                       const char *pattern, const char *str);
+MES_API MESERROR mes_rules_add_line(MesRules *rules, const char *line);
+MES_API MESERROR mes_rules_load(MesRules *rules, const char *path);
+MES_API int mes_rules_count(const MesRules *rules);
+MES_API void mes_rules_free(MesRules *rules);
+
+MES_API MESERROR mes_open(const MesOptions *opts, MesHandle **handle);
+MES_API MESERROR mes_run(MesHandle *h, MesRules *rules,
+                         const char *const *objects,
+                         const char *const *outputs, int count,
+                         mes_result_fn done, void *arg);
+MES_API MESERROR mes_process(MesHandle *h, MesRules *rules,
+                             const char *object, const char *output,
+                             MesResult *result);
+MES_API void mes_stats(const MesHandle *h, MesStats *stats);
+MES_API void mes_close(MesHandle *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MODELFSYMBOL_H
@@ -0,0 +1,42 @@
+#ifndef MOD_ELF_SYMBOL_REPORT_H
+#define MOD_ELF_SYMBOL_REPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "util.h"
+
+typedef enum { REPORT_NONE = 0, REPORT_JSON, REPORT_BINARY } REPORTFORMAT;
+
+typedef enum {
+  REPORT_OK = 0,
+  REPORT_CACHED,
+  REPORT_FAILED,
+  REPORT_SKIPPED // not processed, the run stopped first
+} REPORTSTATUS;
+
+// What was done to one object, filled in from its MesResult
+typedef struct {
+  const char *path;
+  const char *output; // NULL: modified in place
+  REPORTSTATUS status;
+  int renamed;
+  uint64_t bytesAdded; // new string table bytes
+  StrList renames;     // old name, new name, old name, ...
+} ReportObject;
+
+// The binary report is little-endian throughout.  A string is a u32 length
+// followed by that many bytes.
+//   "MESRPT01"
+//   u32 objects, u32 phases, the phase names as strings
+//   per object: string path, string output (empty: in place), u8 status
+//               (REPORTSTATUS), u32 renamed, u64 bytes added, u64 ns per
+//               phase,
+//               u32 renames, then old and new name as strings per rename
+#define REPORT_MAGIC "MESRPT01"
+
+int report_write(int fd, REPORTFORMAT format, ReportObject *objs, int count,
+                 const uint64_t *phaseNs);
+
+#endif // MOD_ELF_SYMBOL_REPORT_H
@@ -0,0 +1,45 @@
+#ifndef MOD_ELF_SYMBOL_RULES_H
+#define MOD_ELF_SYMBOL_RULES_H
+
+#include "matcher.h"
+#include "symindex.h"
+#include "util.h"
+
+typedef enum { SINGLESYM = 0, KEEPNUMSYM, COMPLETESYM } FLAGTYPE;
+
+// One rename.  Symbol 'name' gets 'str' appended (SINGLESYM), 'str' and the
+// object number appended (KEEPNUMSYM) or is replaced by 'str' (COMPLETESYM).
+// A NULL 'str' selects the historical __dmtcp_ defaults.  For a pattern
+// rule 'name' is the prefix, suffix or glob selecting the symbols.
+typedef struct {
+  char *name;
+  char *str;
+  FLAGTYPE ft;
+  MATCHTYPE type;
+} Rule;
+
+// Every rule of a run.  All strings and tables live in 'arena'.
+typedef struct {
+  Arena arena;
+  Rule *rules;
+  int count;
+  int cap;
+  int countByFt[3];
+  int *keepNumRules; // rules that must match, filled by ruleset_finish()
+  int keepNumCount;
+  SymIndex index; // rule name -> rules, built by ruleset_finish()
+  int patternCount;
+  Matcher matcher; // pattern rules, built by ruleset_finish()
+} RuleSet;
+
+int ruleset_add(RuleSet *rs, const char *name, const char *str, FLAGTYPE ft);
+int ruleset_add_pattern(RuleSet *rs, MATCHTYPE type, const char *pattern,
+                        const char *str);
+int ruleset_lookup(const RuleSet *rs, const char *name, size_t maxlen);
+int ruleset_add_line(RuleSet *rs, char *line, const char *where, int lineno);
+int ruleset_load_file(RuleSet *rs, const char *path);
+int ruleset_finish(RuleSet *rs);
+uint64_t ruleset_hash(const RuleSet *rs);
+void ruleset_free(RuleSet *rs);
+
+#endif // MOD_ELF_SYMBOL_RULES_H
@@ -0,0 +1,46 @@
+#ifndef MOD_ELF_SYMBOL_SERVER_H
+#define MOD_ELF_SYMBOL_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "modelfsymbol.h"
+
+#define RULE_CACHE_SIZE 16
+
+// Buffered reader of '\n' terminated lines from a socket
+typedef struct {
+  int fd;
+  char *buf;
+  size_t len; // bytes in buf
+  size_t pos; // start of the next line
+  size_t cap;
+} LineReader;
+
+// Compiled rule sets of recent jobs, keyed by a hash of everything that
+// went into them; the least recently used one is evicted
+typedef struct {
+  uint64_t key;
+  unsigned long lastUse; // 0: slot is free
+  MesRules *rules;
+} RuleCacheEntry;
+
+typedef struct {
+  RuleCacheEntry entries[RULE_CACHE_SIZE];
+  unsigned long clock;
+  unsigned long hits;
+  unsigned long misses;
+} RuleCache;
+
+int server_listen(const char *path);
+int client_connect(const char *path);
+char *line_read(LineReader *lr);
+void line_reader_free(LineReader *lr);
+int sock_printf(int fd, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+uint64_t job_key_update(uint64_t key, const void *data, size_t len);
+MesRules *rule_cache_get(RuleCache *cache, uint64_t key);
+void rule_cache_put(RuleCache *cache, uint64_t key, MesRules *rules);
+void rule_cache_free(RuleCache *cache);
+
+#endif // MOD_ELF_SYMBOL_SERVER_H
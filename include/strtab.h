@@ -0,0 +1,38 @@
+#ifndef MOD_ELF_SYMBOL_STRTAB_H
+#define MOD_ELF_SYMBOL_STRTAB_H
+
+#include <stddef.h>
+
+#include "util.h"
+
+// Interns new names into an existing string table.  A name is only
+// appended when neither the old table nor an earlier appended name already
+// ends with it, so identical names and tail-shared names cost nothing.
+// Its tables live in the arena given to strtab_builder_init().
+typedef struct {
+  unsigned int hash; // hash of the string read backwards
+  unsigned int len;
+  unsigned long offset; // 0 marks an empty slot (offset 0 is always "")
+} StrtabSlot;
+
+typedef struct {
+  Arena *arena;
+  const char *base; // existing table, only read while interning
+  unsigned long size;
+  StrtabSlot *slots;
+  size_t mask;
+  size_t used;
+  unsigned char *want; // want[len] != 0 if some name has this length
+  size_t max_len;
+  char *added; // bytes to append after the existing table
+  size_t added_len;
+  size_t added_cap;
+} StrtabBuilder;
+
+int strtab_builder_init(StrtabBuilder *sb, Arena *arena, const char *base,
+                        unsigned long size, char **names, size_t count,
+                        const unsigned long *skip, size_t nskip);
+int strtab_intern_all(StrtabBuilder *sb, char **names, size_t count,
+                      unsigned long *offsets);
+
+#endif // MOD_ELF_SYMBOL_STRTAB_H
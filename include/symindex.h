@@ -0,0 +1,33 @@
+#ifndef MOD_ELF_SYMBOL_SYMINDEX_H
+#define MOD_ELF_SYMBOL_SYMINDEX_H
+
+#include <stddef.h>
+
+// Open-addressing index from a name to every entry (symbol, rule) carrying
+// that name, in the order they were added
+typedef struct {
+  unsigned int hash;
+  unsigned int len;
+  const char *name; // NULL marks an empty slot
+  long first;       // first entry with this name
+  long last;        // last entry with this name
+} SymIndexSlot;
+
+typedef struct {
+  SymIndexSlot *slots;
+  size_t mask;
+  long *next; // next entry with the same name, -1 terminates
+  size_t nsyms;
+} SymIndex;
+
+unsigned int symindex_hash(const char *name, size_t maxlen, size_t *len);
+int symindex_init(SymIndex *idx, size_t nsyms);
+void symindex_add(SymIndex *idx, long symidx, const char *name,
+                  size_t maxlen);
+long symindex_find(const SymIndex *idx, const char *name);
+long symindex_find_n(const SymIndex *idx, const char *name, size_t maxlen);
+void symindex_free(SymIndex *idx);
+
+#define symindex_next(idx, symidx) ((idx)->next[symidx])
+
+#endif // MOD_ELF_SYMBOL_SYMINDEX_H
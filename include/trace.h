@@ -0,0 +1,49 @@
+#ifndef MOD_ELF_SYMBOL_TRACE_H
+#define MOD_ELF_SYMBOL_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Phases of the work on one object, timed with --trace and --stats
+typedef enum {
+  TRACE_OBJECT = 0, // everything done for the object
+  TRACE_CHECK_ELF,
+  TRACE_FIND_TABLES,
+  TRACE_CHECK_SYMBOLS,
+  TRACE_PLAN_STRTAB,
+  TRACE_COPY,   // out of place: clone the input into the output
+  TRACE_EXTEND, // make room for the new names
+  TRACE_UPDATE,
+  TRACE_REHASH,
+  TRACE_WRITE_ARCHIVE,
+  TRACE_SYNC,   // msync and unmap
+  TRACE_COMMIT, // --commit=atomic: a group of renames, not one object
+  TRACE_PHASES
+} TRACEPHASE;
+
+// Work done by the calling thread so far
+typedef struct {
+  uint64_t bytesRead;
+  uint64_t bytesWritten;
+  uint64_t syscalls;
+} TraceCounters;
+
+// An open phase, see trace_begin()
+typedef struct {
+  TRACEPHASE phase;
+  uint64_t start; // ns
+  TraceCounters counters;
+} TraceSpan;
+
+extern int trace_enabled;
+
+void trace_io(uint64_t read, uint64_t written, uint64_t syscalls);
+void trace_begin(TraceSpan *span, TRACEPHASE phase);
+void trace_end(TraceSpan *span, int object);
+int trace_write_chrome(const char *path, char **objects, int count);
+void trace_object_totals(uint64_t *phaseNs, int count);
+const char *trace_phase_name(TRACEPHASE phase);
+void trace_print_stats(void);
+void trace_free(void);
+
+#endif // MOD_ELF_SYMBOL_TRACE_H
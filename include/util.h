@@ -1,7 +1,89 @@
+#ifndef MOD_ELF_SYMBOL_UTIL_H
+#define MOD_ELF_SYMBOL_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Bump allocator: everything allocated from an arena is released at once
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size;
+  size_t used;
+  char data[];
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock *head;
+} Arena;
+
+// Growable list of strings whose storage lives in an arena
+typedef struct {
+  char **items;
+  int count;
+  int cap;
+} StrList;
+
+// A byte range of a file
+typedef struct {
+  off_t off;
+  size_t len;
+} Extent;
+
+// An object file mapped into memory for the duration of its processing.
+// An in-memory image (an archive member) has no file behind it: fd is -1.
+// A buffered file is read into private memory instead, and the ranges
+// marked dirty are written back when it is flushed.
+typedef struct {
+  char *path;
+  int fd;
+  char *addr;
+  size_t size;
+  int writable; // 0 if we fell back to a read-only private mapping
+  mode_t mode;
+  size_t tail_shift; // bytes the data after .strtab was already moved by
+  int borrowed;      // addr points into someone else's mapping
+
+  int buffered;     // read with preadv, written back with pwritev
+  size_t disk_size; // size of the file itself, while buffered
+  Extent *dirty;
+  int dirtyCount;
+  int dirtyCap;
+  int flushedExtents; // dirty ranges written by the last flush
+  int flushCalls;     // pwritev calls that took
+  int lost;           // a dirty range could not be recorded
+  struct IoRing *ring; // buffered: written back through this ring
+} MappedFile;
+
 int str_starts_with(const char *symbol, const char *prefix);
 int str_ends_with(const char *symbol, const char *suffix);
 int str_index(const char *string, char c);
+uint32_t elf_gnu_hash(const char *name);
+uint32_t elf_sysv_hash(const char *name);
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
 int readall(int fd, char *addr, size_t size);
 int writeall(int fd, char *addr, size_t size);
-void read_metadata(char *file, char *addr, size_t size, off_t offset);
-void write_metadata(char *file, char *addr, size_t size, off_t offset);
+int pwriteall(int fd, const char *addr, size_t size, off_t off);
+int map_file(char *file, MappedFile *mf, int writable, int buffered);
+int map_memory(char *path, char *addr, size_t size, MappedFile *mf,
+               int borrow);
+int resize_mapped_file(MappedFile *mf, size_t size);
+void mark_dirty(MappedFile *mf, const void *addr, size_t len);
+int flush_mapped_file(MappedFile *mf);
+void unmap_file(MappedFile *mf);
+int clone_range(int in_fd, off_t in_off, int out_fd, off_t out_off,
+                size_t len);
+int write_shifted_copy(MappedFile *src, char *file, off_t split, size_t shift,
+                       int exclusive);
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_calloc(Arena *arena, size_t count, size_t size);
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+char *arena_strndup(Arena *arena, const char *str, size_t len);
+char *arena_strdup(Arena *arena, const char *str);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+int strlist_push(Arena *arena, StrList *list, const char *item);
+void json_string(FILE *fp, const char *str);
+
+#endif // MOD_ELF_SYMBOL_UTIL_H
@@ -0,0 +1,16 @@
+#ifndef MOD_ELF_SYMBOL_WORKPOOL_H
+#define MOD_ELF_SYMBOL_WORKPOOL_H
+
+// Run fn(item, arg) for item = 0..nitems-1 on nthreads workers.
+// emit(item, arg) is called on the calling thread, in item order, as soon as
+// every item up to and including 'item' has finished.  When it returns
+// non-zero no further item is started: the items in progress finish, none
+// is emitted after it, and workpool_run() returns 1.
+typedef void (*workpool_fn)(int item, void *arg);
+typedef int (*workpool_emit_fn)(int item, void *arg);
+
+int workpool_run(int nthreads, int nitems, workpool_fn fn,
+                 workpool_emit_fn emit, void *arg);
+int workpool_worker(void);
+
+#endif // MOD_ELF_SYMBOL_WORKPOOL_H
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/archive.h"
+
+static size_t ar_field(const char *field, size_t width) {
+  size_t value = 0;
+  for (size_t i = 0; i < width && field[i] >= '0' && field[i] <= '9'; ++i)
+    value = value * 10 + (field[i] - '0');
+  return value;
+}
+
+// Walk the members of the archive at 'addr'.  The armap and long name
+// table are reported like any other member; names of regular members are
+// resolved through the long name table.  'members' is malloc'd.
+int ar_parse(const char *addr, size_t size, ArMember **members, int *count) {
+  const char *longnames = NULL;
+  size_t longnames_size = 0;
+  size_t pos = AR_MAGIC_SIZE;
+  int cap = 0;
+
+  *members = NULL;
+  *count = 0;
+  if (size < AR_MAGIC_SIZE || memcmp(addr, AR_MAGIC, AR_MAGIC_SIZE) != 0)
+    return -1;
+  while (pos + AR_HDR_SIZE <= size) {
+    const char *hdr = addr + pos;
+    if (hdr[58] != '`' || hdr[59] != '\n') {
+      fprintf(stderr, "ar_parse: bad member header at offset %zu\n", pos);
+      goto fail;
+    }
+    if (*count == cap) {
+      cap = cap ? cap * 2 : 64;
+      ArMember *grown = realloc(*members, cap * sizeof(ArMember));
+      if (grown == NULL) {
+        perror("ar_parse");
+        goto fail;
+      }
+      *members = grown;
+    }
+    ArMember *m = &(*members)[*count];
+    m->hdr = pos;
+    m->data = pos + AR_HDR_SIZE;
+    m->size = ar_field(hdr + 48, 10);
+    if (m->size > size - m->data) {
+      fprintf(stderr, "ar_parse: member at offset %zu is truncated\n",
+              pos);
+      goto fail;
+    }
+    m->kind = AR_MEMBER;
+    m->name = hdr;
+    m->namelen = 16;
+    if (hdr[0] == '/' && hdr[1] == ' ') {
+      m->kind = AR_ARMAP;
+    } else if (memcmp(hdr, "/SYM64/ ", 8) == 0) {
+      m->kind = AR_ARMAP64;
+    } else if (hdr[0] == '/' && hdr[1] == '/' && hdr[2] == ' ') {
+      m->kind = AR_LONGNAMES;
+      longnames = addr + m->data;
+      longnames_size = m->size;
+    } else if (hdr[0] == '/' && hdr[1] >= '0' && hdr[1] <= '9') {
+      size_t off = ar_field(hdr + 1, 15);
+      if (longnames == NULL || off >= longnames_size) {
+        fprintf(stderr, "ar_parse: bad long name reference at offset %zu\n",
+                pos);
+        goto fail;
+      }
+      m->name = longnames + off;
+      m->namelen = longnames_size - off;
+    }
+    // GNU names end at '/', padded with spaces
+    for (size_t i = 0; i < m->namelen; ++i) {
+      if (m->name[i] == '/' || m->name[i] == '\n' ||
+          (m->name == hdr && m->name[i] == ' ')) {
+        m->namelen = i;
+        break;
+      }
+    }
+    (*count)++;
+    pos = m->data + m->size + (m->size & 1);
+  }
+  return 0;
+
+fail:
+  free(*members);
+  *members = NULL;
+  *count = 0;
+  return -1;
+}
+
+// Size of the contents of an armap listing 'nsyms' names of 'names_len'
+// bytes (NULs included), padded to an even size
+size_t ar_armap_size(int nsyms, size_t names_len, int is64) {
+  size_t word = is64 ? 8 : 4;
+  size_t size = word * (1 + (size_t)nsyms) + names_len;
+  return size + (size & 1);
+}
+
+static void put_be(char *p, uint64_t value, size_t width) {
+  for (size_t i = 0; i < width; ++i)
+    p[i] = (char)(value >> (8 * (width - 1 - i)));
+}
+
+// Symbol count, the offset of each symbol's member header and the names,
+// all big endian as the SysV ABI wants
+void ar_write_armap(char *buf, size_t bufsize, int nsyms, const uint64_t *offsets,
+                    char **names, int is64) {
+  size_t word = is64 ? 8 : 4;
+  char *p = buf;
+  memset(buf, 0, bufsize);
+  put_be(p, nsyms, word);
+  p += word;
+  for (int i = 0; i < nsyms; ++i, p += word)
+    put_be(p, offsets[i], word);
+  for (int i = 0; i < nsyms; ++i) {
+    size_t len = strlen(names[i]) + 1;
+    memcpy(p, names[i], len);
+    p += len;
+  }
+}
+
+// Rewrite the size field of a member header
+void ar_patch_header(char *hdr, size_t size) {
+  char field[11];
+  snprintf(field, sizeof(field), "%-10zu", size);
+  memcpy(hdr + 48, field, 10);
+}
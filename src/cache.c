@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "../include/cache.h"
+
+#define CACHE_MAGIC "# mod-elf-symbol manifest 1"
+
+static int compare_in(const void *a, const void *b) {
+  const CacheEntry *x = a, *y = b;
+  if (x->in != y->in)
+    return x->in < y->in ? -1 : 1;
+  return x->rules < y->rules ? -1 : x->rules > y->rules;
+}
+
+static int compare_out(const void *a, const void *b) {
+  const CacheEntry *x = a, *y = b;
+  if (x->out != y->out)
+    return x->out < y->out ? -1 : 1;
+  return x->rules < y->rules ? -1 : x->rules > y->rules;
+}
+
+// Read the manifest at 'path'; a missing manifest is an empty one
+int cache_load(Cache *cache, const char *path) {
+  char line[128];
+  size_t cap = 0;
+  memset(cache, 0, sizeof(*cache));
+  pthread_mutex_init(&cache->lock, NULL);
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL && errno == ENOENT)
+    return 0;
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+  if (fgets(line, sizeof(line), fp) == NULL ||
+      strncmp(line, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0) {
+    fprintf(stderr, "*** ***%s is not a manifest written by this tool.\n",
+            path);
+    fclose(fp);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    unsigned long long in, rules, out;
+    if (sscanf(line, "%llx %llx %llx", &in, &rules, &out) != 3)
+      continue; // damaged line: that object is processed again
+    if (cache->count == cap) {
+      cap = cap ? cap * 2 : 1024;
+      CacheEntry *grown = realloc(cache->entries, cap * sizeof(CacheEntry));
+      if (grown == NULL) {
+        fclose(fp);
+        return -1;
+      }
+      cache->entries = grown;
+    }
+    cache->entries[cache->count++] = (CacheEntry){in, rules, out};
+  }
+  fclose(fp);
+
+  cache->byOut = malloc((cache->count ? cache->count : 1) * sizeof(CacheEntry));
+  if (cache->byOut == NULL)
+    return -1;
+  memcpy(cache->byOut, cache->entries, cache->count * sizeof(CacheEntry));
+  qsort(cache->entries, cache->count, sizeof(CacheEntry), compare_in);
+  qsort(cache->byOut, cache->count, sizeof(CacheEntry), compare_out);
+  return 0;
+}
+
+const CacheEntry *cache_find_in(const Cache *cache, uint64_t in,
+                                uint64_t rules) {
+  CacheEntry key = {in, rules, 0};
+  return bsearch(&key, cache->entries, cache->count, sizeof(CacheEntry),
+                 compare_in);
+}
+
+const CacheEntry *cache_find_out(const Cache *cache, uint64_t out,
+                                 uint64_t rules) {
+  CacheEntry key = {0, rules, out};
+  return bsearch(&key, cache->byOut, cache->count, sizeof(CacheEntry),
+                 compare_out);
+}
+
+// Record an object processed during this run; safe to call from workers
+int cache_add(Cache *cache, uint64_t in, uint64_t rules, uint64_t out) {
+  int rc = 0;
+  pthread_mutex_lock(&cache->lock);
+  if (cache->addedCount == cache->addedCap) {
+    size_t cap = cache->addedCap ? cache->addedCap * 2 : 256;
+    CacheEntry *grown = realloc(cache->added, cap * sizeof(CacheEntry));
+    if (grown == NULL) {
+      rc = -1;
+      goto out;
+    }
+    cache->added = grown;
+    cache->addedCap = cap;
+  }
+  cache->added[cache->addedCount++] = (CacheEntry){in, rules, out};
+out:
+  pthread_mutex_unlock(&cache->lock);
+  return rc;
+}
+
+// Write the old entries and the new ones back to 'path', one entry per
+// (in, rules) with the newest winning.  Goes through a temporary file so
+// that an interrupted run leaves the old manifest.  The entries written
+// are the ones searched from then on, for a cache used by several runs.
+int cache_save(Cache *cache, const char *path) {
+  size_t total = cache->count + cache->addedCount;
+  CacheEntry *all = malloc((total ? total : 1) * sizeof(CacheEntry));
+  char *tmp = malloc(strlen(path) + 5);
+  FILE *fp = NULL;
+  int rc = -1;
+  if (all == NULL || tmp == NULL)
+    goto out;
+  // Merge the sorted old and new entries, new ones first on a tie
+  qsort(cache->added, cache->addedCount, sizeof(CacheEntry), compare_in);
+  size_t a = 0, o = 0, n = 0;
+  while (a < cache->addedCount || o < cache->count) {
+    if (o == cache->count ||
+        (a < cache->addedCount &&
+         compare_in(&cache->added[a], &cache->entries[o]) <= 0))
+      all[n++] = cache->added[a++];
+    else
+      all[n++] = cache->entries[o++];
+  }
+
+  sprintf(tmp, "%s.tmp", path);
+  fp = fopen(tmp, "w");
+  if (fp == NULL) {
+    perror(tmp);
+    goto out;
+  }
+  fprintf(fp, "%s\n", CACHE_MAGIC);
+  for (size_t i = 0; i < total; ++i)
+    if (i == 0 || compare_in(&all[i - 1], &all[i]) != 0)
+      fprintf(fp, "%016llx %016llx %016llx\n",
+              (unsigned long long)all[i].in, (unsigned long long)all[i].rules,
+              (unsigned long long)all[i].out);
+  if (fclose(fp) == EOF || rename(tmp, path) == -1) {
+    perror(path);
+    unlink(tmp);
+    goto out;
+  }
+  rc = 0;
+
+  size_t kept = 0;
+  for (size_t i = 0; i < total; ++i)
+    if (i == 0 || compare_in(&all[i - 1], &all[i]) != 0)
+      all[kept++] = all[i];
+  CacheEntry *byOut = malloc((kept ? kept : 1) * sizeof(CacheEntry));
+  if (byOut == NULL)
+    goto out; // the manifest is saved, the new entries just aren't found
+  memcpy(byOut, all, kept * sizeof(CacheEntry));
+  qsort(byOut, kept, sizeof(CacheEntry), compare_out);
+  free(cache->entries);
+  free(cache->byOut);
+  cache->entries = all;
+  cache->byOut = byOut;
+  cache->count = kept;
+  cache->addedCount = 0;
+  all = NULL;
+out:
+  free(all);
+  free(tmp);
+  return rc;
+}
+
+// Leave the rules and result hash on 'path' together with its size and
+// mtime, so that the next run can recognise it without reading it.
+// Filesystems without user xattrs just don't get the shortcut.
+void cache_mark(const char *path, uint64_t rules, uint64_t out) {
+  struct stat st;
+  char value[128];
+  if (stat(path, &st) == -1)
+    return;
+  int len = snprintf(value, sizeof(value), "%016llx %016llx %llx %llx.%09ld",
+                     (unsigned long long)rules, (unsigned long long)out,
+                     (unsigned long long)st.st_size,
+                     (unsigned long long)st.st_mtim.tv_sec,
+                     st.st_mtim.tv_nsec);
+  setxattr(path, CACHE_XATTR, value, len, 0);
+}
+
+// 1 if 'path' carries a mark for 'rules' and has not been modified since;
+// the hash it had then is returned in 'out'
+int cache_marked(const char *path, uint64_t rules, uint64_t *out) {
+  struct stat st;
+  char value[128];
+  unsigned long long r, o, size, sec;
+  long nsec;
+  ssize_t len = getxattr(path, CACHE_XATTR, value, sizeof(value) - 1);
+  if (len <= 0 || stat(path, &st) == -1)
+    return 0;
+  value[len] = '\0';
+  if (sscanf(value, "%llx %llx %llx %llx.%ld", &r, &o, &size, &sec, &nsec) !=
+      5)
+    return 0;
+  if (r != rules || size != (unsigned long long)st.st_size ||
+      sec != (unsigned long long)st.st_mtim.tv_sec ||
+      nsec != st.st_mtim.tv_nsec)
+    return 0;
+  *out = o;
+  return 1;
+}
+
+void cache_free(Cache *cache) {
+  free(cache->entries);
+  free(cache->byOut);
+  free(cache->added);
+  pthread_mutex_destroy(&cache->lock);
+  memset(cache, 0, sizeof(*cache));
+}
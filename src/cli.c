@@ -0,0 +1,1072 @@
+// The mod-elf-symbol command line tool, a wrapper over libmodelfsymbol
+
+// write, getopt..
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+
+// printf..
+#include <stdio.h>
+
+// exit..
+#include <stdlib.h>
+
+
+// c strings..
+#include <string.h>
+
+// for open..
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// the library
+#include "../include/modelfsymbol.h"
+
+// utilities
+#include "../include/report.h"
+#include "../include/server.h"
+#include "../include/trace.h"
+#include "../include/util.h"
+
+// CONST
+static const int debug_func = 0;
+
+static const char *logLevelNames[] = {"quiet", "summary", "info", "verbose"};
+
+static MesOptions opts = {.jobs = 1, .ioDepth = -1}; // for the library
+static char *outputFile = NULL;
+static char *outputDir = NULL;
+static char *serveSocket = NULL;   // --serve: resident server on this socket
+static char *connectSocket = NULL; // --connect: hand the job to a server
+static int shutdownServer = 0; // --connect --shutdown: stop the server
+static char *traceFile = NULL;  // --trace: Chrome trace of the phases
+static int printStats = 0;      // --stats: per phase summary at the end
+static REPORTFORMAT reportFormat = REPORT_NONE; // --report
+static char *reportFile = NULL; // --report-file, stdout otherwise
+static int reportFd = 1;
+static ReportObject *reports = NULL; // one per object with --report
+static int failedItem = -1; // the object that stopped the run
+static MESERROR failedStatus = MES_OK;
+
+// Symbols and strings given on the command line
+typedef struct {
+  StrList singleSymbols;
+  char *singleStr;
+  StrList keepNumSymbols;
+  char *keepNumStr;
+  StrList completeSymbols;
+  char *completeStr;
+  StrList rulesFiles;
+  StrList patterns[4]; // indexed by MESMATCH, append --singlestr
+} SymbolRequest;
+
+// Helper functions
+int parseLogLevel(const char *name, MESLOGLEVEL *level) {
+  for (int l = MES_LOG_QUIET; l <= MES_LOG_VERBOSE; ++l)
+    if (strcmp(name, logLevelNames[l]) == 0) {
+      *level = l;
+      return 0;
+    }
+  return -1;
+}
+
+int runGetOpt(int argc, char **argv, Arena *arena, StrList *objList,
+              SymbolRequest *req) {
+  if (debug_func)
+    printf("runGetOpt\n");
+  int c;
+  int digit_optind = 0;
+  while (1) {
+    int this_option_optind = optind ? optind : 1;
+    int option_index = 0;
+    static struct option long_options[] = {
+        {"object", required_argument, 0, 0},
+        {"singlesymbol", required_argument, 0, 1},
+        {"keepnumsymbol", required_argument, 0, 2},
+        {"singlestr", required_argument, 0, 3},
+        {"keepnumstr", required_argument, 0, 4},
+        {"completesymbol", required_argument, 0, 7},
+        {"completestr", required_argument, 0, 8},
+        {"only_def", no_argument, 0, 9},
+        {"only_undef", no_argument, 0, 10},
+        {"verbose", no_argument, 0, 'v'},
+        {"jobs", required_argument, 0, 'j'},
+        {"output", required_argument, 0, 11},
+        {"output-dir", required_argument, 0, 12},
+        {"strtab-at-end", no_argument, 0, 13},
+        {"rules", required_argument, 0, 14},
+        {"match-prefix", required_argument, 0, 15},
+        {"match-suffix", required_argument, 0, 16},
+        {"match-glob", required_argument, 0, 17},
+        {"dynamic", no_argument, 0, 18},
+        {"serve", required_argument, 0, 19},
+        {"connect", required_argument, 0, 20},
+        {"shutdown", no_argument, 0, 21},
+        {"trace", required_argument, 0, 22},
+        {"stats", no_argument, 0, 23},
+        {"io", required_argument, 0, 24},
+        {"cache", required_argument, 0, 25},
+        {"log-level", required_argument, 0, 26},
+        {"report", required_argument, 0, 27},
+        {"report-file", required_argument, 0, 28},
+        {"commit", required_argument, 0, 29},
+        {"io-depth", required_argument, 0, 30},
+        {0, 0, 0, 0}};
+
+    c = getopt_long(argc, argv, "o:s:k:c:vj:", long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      printf("option %s", long_options[option_index].name);
+      if (optarg)
+        printf(" with arg %s", optarg);
+      printf("\n");
+
+    case 0: // object
+      if (strlist_push(arena, objList, optarg) == -1)
+        return -1;
+      break;
+    case 'o':
+      optind--;
+      do {
+        if (strlist_push(arena, objList, argv[optind]) == -1)
+          return -1;
+        optind++;
+      } while (optind < argc && *argv[optind] != '-');
+      break;
+
+    case 1: // single symbol
+      if (strlist_push(arena, &req->singleSymbols, optarg) == -1)
+        return -1;
+      break;
+    case 's':
+      optind--;
+      do {
+        if (strlist_push(arena, &req->singleSymbols, argv[optind]) == -1)
+          return -1;
+        optind++;
+      } while (optind < argc && *argv[optind] != '-');
+      break;
+
+    case 2: // multiple symbol requiring numbering
+      if (objList == NULL) {
+        printf("*** ***If need to assign numbering to symbol, list object "
+               "files first!\n");
+        perror("Syntax: ./replace-symbols-name -o <obj file> [obj files] "
+               "--keepnumsymbol=<symbol>");
+        exit(1);
+      }
+      if (strlist_push(arena, &req->keepNumSymbols, optarg) == -1)
+        return -1;
+      break;
+    case 'k':
+      if (objList == NULL) {
+        printf("*** ***If need to assign numbering to symbol, list object "
+               "files first!\n");
+        perror("Syntax: ./replace-symbols-name -o <obj file> [obj files] "
+               "--keepnumsymbol=<symbol>");
+        exit(1);
+      }
+      optind--;
+      do {
+        if (strlist_push(arena, &req->keepNumSymbols, argv[optind]) == -1)
+          return -1;
+        optind++;
+      } while (optind < argc && *argv[optind] != '-');
+      break;
+
+    case 7: // complete symbol replacement
+      if (strlist_push(arena, &req->completeSymbols, optarg) == -1)
+        return -1;
+      break;
+    case 'c':
+      optind--;
+      do {
+        if (strlist_push(arena, &req->completeSymbols, argv[optind]) == -1)
+          return -1;
+        optind++;
+      } while (optind < argc && *argv[optind] != '-');
+      break;
+
+    case 3:
+      if (req->singleStr) {
+        printf("*** ***Only use the flag --singestr=<symbol> once.\n");
+        exit(1);
+      }
+      req->singleStr = arena_strdup(arena, optarg);
+      break;
+    case 4:
+      if (req->keepNumStr) {
+        printf("*** ***Only use the flag --keepnumstr=<symbol> once.\n");
+        exit(1);
+      }
+      req->keepNumStr = arena_strdup(arena, optarg);
+      break;
+    case 8:
+      if (req->completeStr) {
+        printf("*** ***Only use the flag --completestr=<symbol> once.\n");
+        exit(1);
+      }
+      req->completeStr = arena_strdup(arena, optarg);
+      break;
+
+    case 9:
+      if (opts.select == MES_BOTH_DEF_AND_UNDEF) {
+        opts.select = MES_ONLY_DEF;
+      } else {
+        printf("*** ***Only use flag --def or --undef once.\n");
+        exit(1);
+      }
+      break;
+    case 10:
+      if (opts.select == MES_BOTH_DEF_AND_UNDEF) {
+        opts.select = MES_ONLY_UNDEF;
+      } else {
+        printf("*** ***Only use flag --def or --undef once.\n");
+        exit(1);
+      }
+      break;
+
+    case 'v':
+      if (opts.logLevel == MES_LOG_VERBOSE) {
+        printf("*** ***Only use flag --verbose once.\n");
+        exit(1);
+      }
+      opts.logLevel = MES_LOG_VERBOSE;
+      break;
+
+    case 11:
+      if (outputFile || outputDir) {
+        printf("*** ***Only use one of --output or --output-dir, once.\n");
+        exit(1);
+      }
+      outputFile = arena_strdup(arena, optarg);
+      break;
+    case 12:
+      if (outputFile || outputDir) {
+        printf("*** ***Only use one of --output or --output-dir, once.\n");
+        exit(1);
+      }
+      outputDir = arena_strdup(arena, optarg);
+      break;
+
+    case 13:
+      opts.strtabAtEnd = 1;
+      break;
+
+    case 14:
+      if (strlist_push(arena, &req->rulesFiles, optarg) == -1)
+        return -1;
+      break;
+
+    case 15: // symbols selected by pattern get --singlestr appended
+      if (strlist_push(arena, &req->patterns[MES_MATCH_PREFIX], optarg) == -1)
+        return -1;
+      break;
+    case 16:
+      if (strlist_push(arena, &req->patterns[MES_MATCH_SUFFIX], optarg) == -1)
+        return -1;
+      break;
+    case 17:
+      if (strlist_push(arena, &req->patterns[MES_MATCH_GLOB], optarg) == -1)
+        return -1;
+      break;
+
+    case 18:
+      opts.dynamic = 1;
+      break;
+
+    case 19:
+      serveSocket = arena_strdup(arena, optarg);
+      break;
+    case 20:
+      connectSocket = arena_strdup(arena, optarg);
+      break;
+    case 21:
+      shutdownServer = 1;
+      break;
+
+    case 22:
+      traceFile = arena_strdup(arena, optarg);
+      trace_enabled = 1;
+      break;
+    case 23:
+      printStats = 1;
+      trace_enabled = 1;
+      break;
+
+    case 24:
+      if (strcmp(optarg, "mmap") == 0) {
+        opts.io = MES_IO_MMAP;
+      } else if (strcmp(optarg, "buffered") == 0) {
+        opts.io = MES_IO_BUFFERED;
+      } else if (strcmp(optarg, "uring") == 0) {
+        opts.io = MES_IO_URING;
+      } else {
+        printf("*** ***--io takes mmap, buffered or uring.\n");
+        exit(1);
+      }
+      break;
+
+    case 25:
+      opts.cacheFile = arena_strdup(arena, optarg);
+      break;
+
+    case 26:
+      if (parseLogLevel(optarg, &opts.logLevel) == -1) {
+        printf("*** ***--log-level takes quiet, summary, info or verbose.\n");
+        exit(1);
+      }
+      break;
+
+    case 27:
+      if (strcmp(optarg, "json") == 0) {
+        reportFormat = REPORT_JSON;
+      } else if (strcmp(optarg, "binary") == 0) {
+        reportFormat = REPORT_BINARY;
+      } else {
+        printf("*** ***--report takes json or binary.\n");
+        exit(1);
+      }
+      trace_enabled = 1; // for the phase timings
+      break;
+    case 28:
+      reportFile = arena_strdup(arena, optarg);
+      break;
+
+    case 29:
+      if (strcmp(optarg, "inplace") == 0) {
+        opts.commitAtomic = 0;
+      } else if (strcmp(optarg, "atomic") == 0) {
+        opts.commitAtomic = 1;
+      } else {
+        printf("*** ***--commit takes inplace or atomic.\n");
+        exit(1);
+      }
+      break;
+
+    case 30:
+      opts.ioDepth = atoi(optarg);
+      if (opts.ioDepth < 0) {
+        printf("*** ***--io-depth takes a number of objects.\n");
+        exit(1);
+      }
+      break;
+
+    case 'j':
+      opts.jobs = atoi(optarg);
+      if (opts.jobs < 1) {
+        printf("*** ***-j/--jobs needs a positive number of workers.\n");
+        exit(1);
+      }
+      break;
+
+    case '?':
+      printf("\n*** invalid option given. (look above)\n\n");
+      return -1;
+      break;
+
+    default:
+      printf("?? getopt returned character code 0%o ??\n", c);
+      return -1;
+      break;
+    }
+  }
+
+  if (optind < argc) {
+    printf("non-option ARGV-elements: ");
+    while (optind < argc)
+      printf("%s ", argv[optind++]);
+    printf("\n");
+  }
+
+  return 0;
+}
+
+void printObjectFileNames(int count, char *list[]) {
+  if (debug_func)
+    printf("printObjectFileNames\n");
+  printf("The object files to modify are:\n");
+  for (int i = 0; i < count; ++i)
+    printf("(%d)\t%s\n", i, list[i]);
+}
+
+void printSymbolsToChange(int count, char *list[], char *str, MESRULE ft) {
+  if (debug_func)
+    printf("printSymbolsToChange\n");
+  switch (ft) {
+  case MES_APPEND:
+    printf("\n%s", "Single Symbols ");
+    break;
+  case MES_NUMBER:
+    printf("\n%s", "Keep number Symbols ");
+    break;
+  case MES_RENAME:
+    printf("\n%s", "Complete Symbols ");
+    break;
+  default:
+    printf("*** ***Unknown flagtype in printSymbolsToChange function.");
+    exit(1);
+  }
+  printf("%s\n", "planned on changing:");
+  for (int i = 0; i < count; ++i) {
+    printf("(%d)\t%s --> ", i, list[i]);
+    switch (ft) {
+    case MES_APPEND:
+      printf("%s%s\n", list[i], str ? str : "__dmtcp_plt");
+      break;
+    case MES_NUMBER:
+      if (str)
+        printf("%s%s*\n", list[i], str);
+      else
+        printf("%s__dmtcp_*\n", list[i]);
+      break;
+    case MES_RENAME:
+      printf("%s\n", str);
+      break;
+    }
+  }
+}
+
+void printPatternsToChange(int count, char *list[], char *str,
+                           MESMATCH type) {
+  if (debug_func)
+    printf("printPatternsToChange\n");
+  static const char *kinds[] = {"", "prefix", "suffix", "glob"};
+  printf("\nSymbols matching %s planned on changing:\n", kinds[type]);
+  for (int i = 0; i < count; ++i)
+    printf("(%d)\t%s%s%s --> <symbol>%s\n", i,
+           type == MES_MATCH_SUFFIX ? "*" : "", list[i],
+           type == MES_MATCH_PREFIX ? "*" : "", str ? str : "__dmtcp_plt");
+}
+
+
+
+// Where each of the 'count' objects is written: --output, or under
+// --output-dir by its base name; NULL to modify them in place
+char **outputPaths(Arena *arena, char **objs, int count, char *file,
+                   char *dir) {
+  if (file == NULL && dir == NULL)
+    return NULL;
+  char **outs = arena_calloc(arena, count ? count : 1, sizeof(char *));
+  if (outs == NULL)
+    return NULL;
+  for (int i = 0; i < count; ++i) {
+    if (file) {
+      outs[i] = file;
+      continue;
+    }
+    char *base = strrchr(objs[i], '/');
+    base = base ? base + 1 : objs[i];
+    outs[i] = arena_alloc(arena, strlen(dir) + strlen(base) + 2);
+    if (outs[i] == NULL)
+      return NULL;
+    sprintf(outs[i], "%s/%s", dir, base);
+  }
+  return outs;
+}
+
+// Write the --report on the first 'count' objects
+int writeReport(int count) {
+  if (debug_func)
+    printf("writeReport\n");
+  int fd = reportFd, rc = -1;
+  uint64_t *phaseNs =
+      calloc((size_t)(count ? count : 1) * TRACE_PHASES, sizeof(uint64_t));
+  if (phaseNs == NULL)
+    return -1;
+  trace_object_totals(phaseNs, count);
+  if (reportFile)
+    fd = open(reportFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    perror(reportFile);
+  } else {
+    rc = report_write(fd, reportFormat, reports, count, phaseNs);
+    if (reportFile && close(fd) == -1) {
+      perror(reportFile);
+      rc = -1;
+    }
+  }
+  free(phaseNs);
+  return rc;
+}
+
+// Print the report of each object as it is done, in command line order;
+// the first failure stops the run, main() reports it once the objects in
+// progress are finished.  Objects that had already been changed when the
+// run stopped are still reported after it.
+int printResult(const MesResult *result, int item, void *arg) {
+  fwrite(result->log, 1, result->logLen, stdout);
+  if (failedItem != -1 && result->status == MES_OK)
+    printf("*** ***%s was changed before the run stopped.\n", result->path);
+  if (reports) {
+    ReportObject *obj = &reports[item];
+    obj->path = result->path;
+    obj->output = result->output;
+    obj->status = result->status != MES_OK ? REPORT_FAILED
+                  : result->cached          ? REPORT_CACHED
+                                            : REPORT_OK;
+    obj->renamed = result->renamed;
+    obj->bytesAdded = result->bytesAdded;
+    obj->renames.items = (char **)result->renames;
+    obj->renames.count = 2 * result->renameCount;
+  }
+  if (result->status != MES_OK && failedItem == -1) {
+    failedItem = item;
+    failedStatus = result->status;
+  }
+  return result->status != MES_OK;
+}
+
+// Server mode.  A client sends jobs as lines:
+//   option dynamic|strtab-at-end|only_def|only_undef|verbose
+//   option log-level quiet|summary|info|verbose
+//   option commit-atomic
+//   option io-uring
+//   option io-depth <objects>
+//   output FILE | output-dir DIR
+//   rule <a line in rules file syntax>
+//   rules FILE
+//   object FILE
+//   end              run the job
+//   shutdown         stop the server
+// and gets back, per object in order, its report as '# ' lines followed by
+// 'OK FILE' or 'ERR FILE', then 'DONE <ok> <failed> cached|compiled'.
+// Compiled rule sets are kept between jobs, keyed by the rule lines and
+// the name, mtime and size of every rules file.
+typedef struct {
+  int fd;
+  int ok;
+  int failed;
+} ServeJob;
+
+static unsigned long jobsServed = 0;
+
+int serveResult(const MesResult *result, int item, void *arg) {
+  ServeJob *job = arg;
+  for (const char *line = result->log, *end = result->log + result->logLen;
+       line < end;) {
+    const char *nl = memchr(line, '\n', end - line);
+    int len = nl ? nl - line : end - line;
+    sock_printf(job->fd, "# %.*s\n", len, line);
+    line += len + 1;
+  }
+  if (result->status != MES_OK) {
+    job->failed++;
+    sock_printf(job->fd, "ERR %s\n", result->path);
+  } else {
+    job->ok++;
+    sock_printf(job->fd, "OK %s\n", result->path);
+  }
+  return 0;
+}
+
+// Read and run one job.  0 when done, 1 on shutdown, -1 when the client
+// went away.
+int serveJob(int fd, LineReader *lr, RuleCache *cache) {
+  if (debug_func)
+    printf("serveJob\n");
+  Arena arena = {0};
+  StrList ruleLines = {0}, rulesFiles = {0}, objects = {0};
+  char *file = NULL, *dir = NULL;
+  char *line;
+  uint64_t key = 0;
+  int rc = -1;
+
+  // Options only last for the job; the server's workers serve them all
+  MesOptions jobOpts;
+  mes_options_init(&jobOpts);
+  jobOpts.jobs = opts.jobs;
+  while ((line = line_read(lr)) != NULL) {
+    int err = 0;
+    if (strcmp(line, "end") == 0) {
+      rc = 0;
+      break;
+    } else if (strcmp(line, "shutdown") == 0) {
+      rc = 1;
+      break;
+    } else if (str_starts_with(line, "object ")) {
+      err = strlist_push(&arena, &objects, line + 7);
+    } else if (str_starts_with(line, "rule ")) {
+      err = strlist_push(&arena, &ruleLines, line + 5);
+      key = job_key_update(key, line, strlen(line) + 1);
+    } else if (str_starts_with(line, "rules ")) {
+      struct stat st;
+      memset(&st, 0, sizeof(st));
+      stat(line + 6, &st); // a missing file fails when it is loaded
+      err = strlist_push(&arena, &rulesFiles, line + 6);
+      key = job_key_update(key, line, strlen(line) + 1);
+      key = job_key_update(key, &st.st_mtim, sizeof(st.st_mtim));
+      key = job_key_update(key, &st.st_size, sizeof(st.st_size));
+    } else if (str_starts_with(line, "output ")) {
+      file = arena_strdup(&arena, line + 7);
+    } else if (str_starts_with(line, "output-dir ")) {
+      dir = arena_strdup(&arena, line + 11);
+    } else if (strcmp(line, "option dynamic") == 0) {
+      jobOpts.dynamic = 1;
+    } else if (strcmp(line, "option strtab-at-end") == 0) {
+      jobOpts.strtabAtEnd = 1;
+    } else if (strcmp(line, "option only_def") == 0) {
+      jobOpts.select = MES_ONLY_DEF;
+    } else if (strcmp(line, "option only_undef") == 0) {
+      jobOpts.select = MES_ONLY_UNDEF;
+    } else if (strcmp(line, "option verbose") == 0) {
+      jobOpts.logLevel = MES_LOG_VERBOSE;
+    } else if (str_starts_with(line, "option log-level ") &&
+               parseLogLevel(line + 17, &jobOpts.logLevel) == 0) {
+    } else if (strcmp(line, "option io-buffered") == 0) {
+      jobOpts.io = MES_IO_BUFFERED;
+    } else if (strcmp(line, "option commit-atomic") == 0) {
+      jobOpts.commitAtomic = 1;
+    } else if (strcmp(line, "option io-uring") == 0) {
+      jobOpts.io = MES_IO_URING;
+    } else if (str_starts_with(line, "option io-depth ") &&
+               atoi(line + 16) >= 0) {
+      jobOpts.ioDepth = atoi(line + 16);
+    } else {
+      sock_printf(fd, "ERR - unknown request: %s\n", line);
+    }
+    if (err == -1)
+      break;
+  }
+  if (rc != 0) {
+    arena_free(&arena);
+    return rc;
+  }
+
+  ServeJob job = {.fd = fd};
+  MesRules *rules = rule_cache_get(cache, key);
+  int cached = rules != NULL;
+  if (rules == NULL) {
+    int bad = (rules = mes_rules_new()) == NULL;
+    for (int i = 0; i < ruleLines.count && !bad; ++i)
+      bad = mes_rules_add_line(rules, ruleLines.items[i]) != MES_OK;
+    for (int i = 0; i < rulesFiles.count && !bad; ++i)
+      bad = mes_rules_load(rules, rulesFiles.items[i]) != MES_OK;
+    if (bad) {
+      mes_rules_free(rules);
+      sock_printf(fd, "ERR - the rules could not be read\n");
+      sock_printf(fd, "DONE 0 %d compiled\n", objects.count);
+      arena_free(&arena);
+      return 0;
+    }
+    rule_cache_put(cache, key, rules);
+  }
+  if (file && objects.count != 1) {
+    sock_printf(fd, "ERR - output takes exactly one object\n");
+    sock_printf(fd, "DONE 0 %d %s\n", objects.count,
+                cached ? "cached" : "compiled");
+    arena_free(&arena);
+    return 0;
+  }
+
+  MesHandle *h;
+  char **outputs = outputPaths(&arena, objects.items, objects.count, file,
+                               dir);
+  if ((file || dir) && outputs == NULL) {
+    arena_free(&arena);
+    return -1;
+  }
+  if (mes_open(&jobOpts, &h) != MES_OK) {
+    arena_free(&arena);
+    return -1;
+  }
+  if (mes_run(h, rules, (const char *const *)objects.items,
+              (const char *const *)outputs, objects.count, serveResult,
+              &job) == MES_ERR_COMMIT)
+    sock_printf(fd, "ERR - the results could not all be committed\n");
+  sock_printf(fd, "DONE %d %d %s\n", job.ok, job.failed,
+              cached ? "cached" : "compiled");
+  jobsServed++;
+  mes_close(h);
+  arena_free(&arena);
+  return 0;
+}
+
+int runServer(char *path) {
+  if (debug_func)
+    printf("runServer\n");
+  RuleCache cache;
+  int stop = 0;
+  int lfd = server_listen(path);
+  if (lfd == -1)
+    return -1;
+  memset(&cache, 0, sizeof(cache));
+  if (opts.logLevel >= MES_LOG_SUMMARY)
+    printf("Serving on %s\n", path);
+  fflush(stdout);
+
+  while (!stop) {
+    int fd = accept(lfd, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("accept");
+      break;
+    }
+    LineReader lr = {.fd = fd};
+    // A connection can carry any number of jobs
+    for (;;) {
+      int rc = serveJob(fd, &lr, &cache);
+      if (rc == 1)
+        stop = 1;
+      if (rc != 0)
+        break;
+    }
+    line_reader_free(&lr);
+    close(fd);
+  }
+  if (opts.logLevel >= MES_LOG_SUMMARY)
+    printf("%lu job(s) served, rule sets: %lu cached, %lu compiled\n",
+           jobsServed, cache.hits, cache.misses);
+  close(lfd);
+  unlink(path);
+  rule_cache_free(&cache);
+  return 0;
+}
+
+// 'path' relative to the client's working directory made absolute, since
+// the server runs elsewhere
+char *absolutePath(Arena *arena, const char *path) {
+  char cwd[4096];
+  if (path[0] == '/' || getcwd(cwd, sizeof(cwd)) == NULL)
+    return arena_strdup(arena, path);
+  char *abs = arena_alloc(arena, strlen(cwd) + strlen(path) + 2);
+  if (abs != NULL)
+    sprintf(abs, "%s/%s", cwd, path);
+  return abs;
+}
+
+// Client mode: send the command line as one job to the server at 'path'
+// and print what comes back
+int runClient(char *path, Arena *arena, StrList *objList,
+              SymbolRequest *req) {
+  if (debug_func)
+    printf("runClient\n");
+  static const char *kinds[] = {"", "prefix", "suffix", "glob"};
+  char *singleStr = req->singleStr ? req->singleStr : "__dmtcp_plt";
+  char *keepNumStr = req->keepNumStr ? req->keepNumStr : "__dmtcp_";
+  int fd = client_connect(path);
+  if (fd == -1)
+    return -1;
+  if (shutdownServer) {
+    int rc = sock_printf(fd, "shutdown\n");
+    close(fd);
+    return rc;
+  }
+
+  if (opts.dynamic)
+    sock_printf(fd, "option dynamic\n");
+  if (opts.strtabAtEnd)
+    sock_printf(fd, "option strtab-at-end\n");
+  if (opts.select == MES_ONLY_DEF)
+    sock_printf(fd, "option only_def\n");
+  if (opts.select == MES_ONLY_UNDEF)
+    sock_printf(fd, "option only_undef\n");
+  if (opts.logLevel != MES_LOG_QUIET)
+    sock_printf(fd, "option log-level %s\n", logLevelNames[opts.logLevel]);
+  if (opts.io == MES_IO_URING)
+    sock_printf(fd, "option io-uring\n");
+  else if (opts.io == MES_IO_BUFFERED)
+    sock_printf(fd, "option io-buffered\n");
+  if (opts.ioDepth != -1)
+    sock_printf(fd, "option io-depth %d\n", opts.ioDepth);
+  if (opts.commitAtomic)
+    sock_printf(fd, "option commit-atomic\n");
+  if (outputFile)
+    sock_printf(fd, "output %s\n", absolutePath(arena, outputFile));
+  if (outputDir)
+    sock_printf(fd, "output-dir %s\n", absolutePath(arena, outputDir));
+  for (int i = 0; i < req->singleSymbols.count; ++i)
+    sock_printf(fd, "rule append %s %s\n", req->singleSymbols.items[i],
+                singleStr);
+  for (int i = 0; i < req->keepNumSymbols.count; ++i)
+    sock_printf(fd, "rule number %s %s\n", req->keepNumSymbols.items[i],
+                keepNumStr);
+  for (int i = 0; i < req->completeSymbols.count; ++i)
+    sock_printf(fd, "rule rename %s %s\n", req->completeSymbols.items[i],
+                req->completeStr);
+  for (int t = MES_MATCH_PREFIX; t <= MES_MATCH_GLOB; ++t)
+    for (int i = 0; i < req->patterns[t].count; ++i)
+      sock_printf(fd, "rule %s %s %s\n", kinds[t], req->patterns[t].items[i],
+                  singleStr);
+  for (int i = 0; i < req->rulesFiles.count; ++i)
+    sock_printf(fd, "rules %s\n", absolutePath(arena, req->rulesFiles.items[i]));
+  for (int i = 0; i < objList->count; ++i)
+    sock_printf(fd, "object %s\n", absolutePath(arena, objList->items[i]));
+  if (sock_printf(fd, "end\n") == -1) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+
+  LineReader lr = {.fd = fd};
+  char *line;
+  int rc = -1;
+  while ((line = line_read(&lr)) != NULL) {
+    if (str_starts_with(line, "# ")) {
+      puts(line + 2);
+    } else if (str_starts_with(line, "DONE ")) {
+      int ok = 0, failed = 0;
+      sscanf(line + 5, "%d %d", &ok, &failed);
+      if (opts.logLevel >= MES_LOG_SUMMARY || failed)
+        printf("%d object(s) done, %d failed\n", ok, failed);
+      rc = failed ? -1 : 0;
+      break;
+    } else if (!str_starts_with(line, "OK ") ||
+               opts.logLevel >= MES_LOG_INFO) {
+      puts(line);
+    }
+  }
+  if (line == NULL)
+    printf("*** ***The server at %s closed the connection.\n", path);
+  line_reader_free(&lr);
+  close(fd);
+  return rc;
+}
+
+// Exit with the library's reason when it turns down the rule for 'name'
+void checkRule(MESERROR err, const char *name) {
+  if (err == MES_OK)
+    return;
+  printf("*** ***Could not add the rule for %s: %s.\n", name,
+         mes_strerror(err));
+  exit(1);
+}
+
+// Main
+int main(int argc, char **argv) {
+  if (debug_func)
+    printf("main\n");
+  Arena arena = {0};
+  StrList objList = {0};
+  SymbolRequest req = {0};
+
+  // Parse the arguments!  Everything they produce lives in 'arena'
+  if (runGetOpt(argc, argv, &arena, &objList, &req) == -1) {
+    printf("*** ***Could not read the command line.\n");
+    exit(1);
+  }
+  if (serveSocket && opts.cacheFile) {
+    printf("*** ***--cache cannot be used with --serve.\n");
+    exit(1);
+  }
+  if (reportFormat && (serveSocket || connectSocket)) {
+    printf("*** ***--report cannot be used with --serve or --connect.\n");
+    exit(1);
+  }
+  if (reportFile && !reportFormat) {
+    printf("*** ***--report-file needs --report=json|binary.\n");
+    exit(1);
+  }
+  // A report on stdout gets stdout to itself, everything else goes to
+  // stderr
+  if (reportFormat && !reportFile) {
+    reportFd = dup(1);
+    if (reportFd == -1 || dup2(2, 1) == -1) {
+      perror("dup");
+      exit(1);
+    }
+  }
+  opts.collectRenames = reportFormat != REPORT_NONE;
+
+  if (opts.logLevel >= MES_LOG_INFO)
+    printf(
+        "\n\n%s\n\n",
+        "+++++++++++++++++++++++++++++++++ Started replace-symbols-name Program");
+  if (serveSocket)
+    exit(runServer(serveSocket) == -1);
+  if (connectSocket && shutdownServer)
+    exit(runClient(connectSocket, &arena, &objList, &req) == -1);
+
+  if (argc < 4) {
+    // perror("Syntax: ./change-symbol-names <obj file> symbol [othersymbols]");
+    perror("Syntax: ./replace-symbols-name [-o | -s | --singlesymbol | "
+           "--keepnumsymbol | --match-prefix | --match-suffix | "
+           "--match-glob | --rules <file>] [-j <jobs>] "
+           "[--serve | --connect <socket>] [--trace <file>] [--stats] "
+           "[--io=mmap|buffered|uring] [--io-depth <objects>] "
+           "[--cache <manifest>] "
+           "[--commit=inplace|atomic] "
+           "[--log-level=quiet|summary|info|verbose] "
+           "[--report=json|binary [--report-file <file>]]");
+    exit(1);
+  }
+  if (outputFile && objList.count != 1) {
+    printf("*** ***--output takes exactly one object, use --output-dir.\n");
+    exit(1);
+  }
+
+  if (opts.logLevel >= MES_LOG_INFO) {
+    // Let user know which object files are going to change
+    printObjectFileNames(objList.count, objList.items);
+
+    // Let user know which symbols are going to change
+    if (req.singleSymbols.count)
+      printSymbolsToChange(req.singleSymbols.count, req.singleSymbols.items,
+                           req.singleStr, MES_APPEND);
+    if (req.keepNumSymbols.count)
+      printSymbolsToChange(req.keepNumSymbols.count, req.keepNumSymbols.items,
+                           req.keepNumStr, MES_NUMBER);
+    if (req.completeSymbols.count)
+      printSymbolsToChange(req.completeSymbols.count,
+                           req.completeSymbols.items, req.completeStr,
+                           MES_RENAME);
+    for (int t = MES_MATCH_PREFIX; t <= MES_MATCH_GLOB; ++t)
+      if (req.patterns[t].count)
+        printPatternsToChange(req.patterns[t].count, req.patterns[t].items,
+                              req.singleStr, t);
+    printf("\n\n");
+  }
+  if (req.completeSymbols.count && !req.completeStr) {
+    printf("*** ***Complete symbols need --completestr=<symbol>.\n");
+    exit(1);
+  }
+
+  // Let a resident server do the work
+  if (connectSocket) {
+    int rc = runClient(connectSocket, &arena, &objList, &req);
+    arena_free(&arena);
+    if (opts.logLevel >= MES_LOG_INFO)
+      printf("\n\n%s\n\n", "Finished replace-symbols-name Program "
+                           "+++++++++++++++++++++++++++++++++");
+    exit(rc == -1);
+  }
+
+  // Command line symbols first, then the rules files in the order given
+  MesRules *rules = mes_rules_new();
+  if (rules == NULL) {
+    printf("*** ***%s.\n", mes_strerror(MES_ERR_NOMEM));
+    exit(1);
+  }
+  for (int i = 0; i < req.singleSymbols.count; ++i)
+    checkRule(mes_rules_add(rules, MES_APPEND, req.singleSymbols.items[i],
+                            req.singleStr),
+              req.singleSymbols.items[i]);
+  for (int i = 0; i < req.keepNumSymbols.count; ++i)
+    checkRule(mes_rules_add(rules, MES_NUMBER, req.keepNumSymbols.items[i],
+                            req.keepNumStr),
+              req.keepNumSymbols.items[i]);
+  for (int i = 0; i < req.completeSymbols.count; ++i)
+    checkRule(mes_rules_add(rules, MES_RENAME, req.completeSymbols.items[i],
+                            req.completeStr),
+              req.completeSymbols.items[i]);
+  for (int t = MES_MATCH_PREFIX; t <= MES_MATCH_GLOB; ++t)
+    for (int i = 0; i < req.patterns[t].count; ++i)
+      checkRule(mes_rules_add_pattern(rules, t, req.patterns[t].items[i],
+                                      req.singleStr),
+                req.patterns[t].items[i]);
+  for (int i = 0; i < req.rulesFiles.count; ++i) {
+    int before = mes_rules_count(rules);
+    if (mes_rules_load(rules, req.rulesFiles.items[i]) != MES_OK)
+      exit(1);
+    if (opts.logLevel >= MES_LOG_INFO)
+      printf("%d rule(s) read from %s\n", mes_rules_count(rules) - before,
+             req.rulesFiles.items[i]);
+  }
+
+  MesHandle *h;
+  MesStats stats;
+  MESERROR err = mes_open(&opts, &h);
+  if (err != MES_OK) {
+    if (err != MES_ERR_CACHE)
+      printf("*** ***%s.\n", mes_strerror(err));
+    exit(1);
+  }
+  mes_stats(h, &stats);
+  if (opts.cacheFile && opts.logLevel >= MES_LOG_INFO)
+    printf("%zu object(s) in %s\n", stats.cacheSize, opts.cacheFile);
+  fflush(stdout);
+
+  char **outputs = outputPaths(&arena, objList.items, objList.count,
+                               outputFile, outputDir);
+  if (reportFormat)
+    reports = calloc(objList.count ? objList.count : 1, sizeof(ReportObject));
+  if ((outputs == NULL && (outputFile || outputDir)) ||
+      (reportFormat && reports == NULL)) {
+    printf("*** ***%s.\n", mes_strerror(MES_ERR_NOMEM));
+    exit(1);
+  }
+
+  // Objects are independent: the library spreads them over the workers,
+  // reports are still printed in command line order.
+  err = mes_run(h, rules, (const char *const *)objList.items,
+                (const char *const *)outputs, objList.count, printResult,
+                NULL);
+  if (failedStatus == MES_ERR_COMMIT) {
+    printf("*** ***Could not commit the results.\n");
+    exit(1);
+  }
+  if (failedItem != -1) {
+    fflush(stdout);
+    fprintf(stderr, "*** ***Failed to process %s\n",
+            objList.items[failedItem]);
+    // The report covers every object; those the stop left alone are
+    // 'skipped'
+    if (reports) {
+      for (int i = 0; i < objList.count; ++i)
+        if (reports[i].path == NULL) {
+          reports[i].path = objList.items[i];
+          reports[i].status = REPORT_SKIPPED;
+        }
+      writeReport(objList.count);
+    }
+    exit(1);
+  }
+  if (err == MES_ERR_COMMIT) {
+    printf("*** ***Could not commit the results.\n");
+    exit(1);
+  }
+  if (err != MES_OK)
+    exit(1);
+
+  mes_stats(h, &stats);
+  if (opts.io == MES_IO_URING && stats.readAhead == MES_READAHEAD_FADVISE &&
+      opts.logLevel >= MES_LOG_INFO)
+    printf("io_uring is not available, reading ahead with posix_fadvise\n");
+  if (opts.logLevel >= MES_LOG_SUMMARY)
+    printf("Summary: %d object(s), %ld symbol(s) renamed\n", objList.count,
+           stats.renamed);
+  if (opts.io != MES_IO_MMAP && opts.logLevel >= MES_LOG_SUMMARY)
+    printf("Writeback: %ld dirty range(s) in %ld %s call(s), %ld "
+           "syscall(s) saved\n",
+           stats.ioExtents, stats.ioCalls,
+           stats.readAhead == MES_READAHEAD_URING ? "io_uring_enter"
+                                                  : "pwritev",
+           stats.ioExtents - stats.ioCalls);
+  if (stats.readAhead == MES_READAHEAD_URING &&
+      opts.logLevel >= MES_LOG_SUMMARY)
+    printf("Read-ahead: %ld of %d object(s) read through io_uring, %ld "
+           "io_uring_enter call(s)\n",
+           stats.prefetched, objList.count, stats.ringCalls);
+  else if (stats.readAhead == MES_READAHEAD_FADVISE &&
+           opts.logLevel >= MES_LOG_SUMMARY)
+    printf("Read-ahead: posix_fadvise on the next %d object(s)\n",
+           stats.ioDepth);
+  if (opts.commitAtomic && opts.logLevel >= MES_LOG_SUMMARY)
+    printf("Commit: %ld object(s) renamed into place, %ld sync call(s)\n",
+           stats.committed, stats.syncs);
+  if (opts.cacheFile && opts.logLevel >= MES_LOG_SUMMARY)
+    printf("Cache: %ld object(s) skipped, %ld processed\n", stats.cached,
+           objList.count - stats.cached);
+  if (printStats)
+    trace_print_stats();
+  if (traceFile && trace_write_chrome(traceFile, objList.items,
+                                      objList.count) == 0 &&
+      opts.logLevel >= MES_LOG_SUMMARY)
+    printf("Trace written to %s\n", traceFile);
+  if (reportFormat && writeReport(objList.count) == -1)
+    exit(1);
+  trace_free();
+  mes_close(h);
+  mes_rules_free(rules);
+  free(reports);
+  arena_free(&arena);
+
+  if (opts.logLevel >= MES_LOG_INFO)
+    printf("\n\n%s\n\n", "Finished replace-symbols-name Program "
+                         "+++++++++++++++++++++++++++++++++");
+}
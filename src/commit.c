@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/commit.h"
+#include "../include/trace.h"
+
+int commit_add(CommitBatch *batch, char *tmp, char *target) {
+  if (batch->count == batch->cap) {
+    int cap = batch->cap ? batch->cap * 2 : COMMIT_GROUP;
+    CommitEntry *grown = realloc(batch->entries, cap * sizeof(CommitEntry));
+    if (grown == NULL)
+      return -1;
+    batch->entries = grown;
+    batch->cap = cap;
+  }
+  batch->entries[batch->count++] = (CommitEntry){tmp, target};
+  return 0;
+}
+
+// Length of the directory part of 'path', 0 for the current directory
+static size_t dir_len(const char *path) {
+  const char *slash = strrchr(path, '/');
+  return slash ? (size_t)(slash - path) + 1 : 0;
+}
+
+static int compare_dirs(const void *a, const void *b) {
+  const char *x = ((const CommitEntry *)a)->target;
+  const char *y = ((const CommitEntry *)b)->target;
+  size_t lx = dir_len(x), ly = dir_len(y);
+  int c = memcmp(x, y, lx < ly ? lx : ly);
+  return c ? c : (lx > ly) - (lx < ly);
+}
+
+// Commit every result of the batch, so that after a crash each target is
+// either its old or its new contents:
+//   1. syncfs() once per filesystem makes all the temporary files durable,
+//   2. each is renamed over its target,
+//   3. fsync() once per directory makes the renames durable.
+// That is a few calls per group rather than two per object.
+int commit_flush(CommitBatch *batch) {
+  if (batch->count == 0)
+    return 0;
+  int n = batch->count, ndirs = 0, ndevs = 0, rc = 0;
+  int *dirfd = malloc((n ? n : 1) * sizeof(int));
+  int *first = malloc((n + 1) * sizeof(int)); // entries of each directory
+  dev_t *devs = malloc((n ? n : 1) * sizeof(dev_t));
+  TraceSpan span;
+
+  batch->count = 0;
+  trace_begin(&span, TRACE_COMMIT);
+  if (dirfd == NULL || first == NULL || devs == NULL)
+    goto fail;
+  qsort(batch->entries, n, sizeof(CommitEntry), compare_dirs);
+  for (int i = 0; i < n; ++i) {
+    CommitEntry *e = &batch->entries[i];
+    if (i > 0 && compare_dirs(&batch->entries[i - 1], e) == 0)
+      continue;
+    size_t len = dir_len(e->target);
+    char *dir = len ? strndup(e->target, len) : strdup(".");
+    struct stat st;
+    first[ndirs] = i;
+    dirfd[ndirs] = dir ? open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (dirfd[ndirs] == -1 || fstat(dirfd[ndirs], &st) == -1) {
+      perror(dir ? dir : e->target);
+      if (dirfd[ndirs] != -1)
+        close(dirfd[ndirs]);
+      free(dir);
+      goto fail;
+    }
+    free(dir);
+    ndirs++;
+    int seen = 0;
+    for (int d = 0; d < ndevs && !seen; ++d)
+      seen = devs[d] == st.st_dev;
+    if (seen)
+      continue;
+    devs[ndevs++] = st.st_dev;
+    batch->syncs++;
+    if (syncfs(dirfd[ndirs - 1]) == -1) {
+      perror("syncfs");
+      goto fail;
+    }
+  }
+  first[ndirs] = n;
+  trace_io(0, 0, 2 * ndirs + ndevs);
+
+  for (int d = 0; d < ndirs; ++d) {
+    for (int i = first[d]; i < first[d + 1]; ++i) {
+      CommitEntry *e = &batch->entries[i];
+      size_t len = dir_len(e->target);
+      if (renameat2(dirfd[d], e->tmp + len, dirfd[d], e->target + len, 0) ==
+          -1) {
+        perror(e->target);
+        unlink(e->tmp);
+        rc = -1;
+        continue;
+      }
+      batch->committed++;
+    }
+    batch->syncs++;
+    if (fsync(dirfd[d]) == -1) {
+      perror("fsync");
+      rc = -1;
+    }
+  }
+  trace_io(0, 0, n + ndirs);
+  goto out;
+
+fail:
+  // Nothing was renamed: every target keeps its old contents
+  for (int i = 0; i < n; ++i)
+    unlink(batch->entries[i].tmp);
+  rc = -1;
+out:
+  for (int d = 0; dirfd && d < ndirs; ++d)
+    close(dirfd[d]);
+  trace_end(&span, -1);
+  free(dirfd);
+  free(first);
+  free(devs);
+  return rc;
+}
+
+void commit_free(CommitBatch *batch) {
+  free(batch->entries);
+  memset(batch, 0, sizeof(*batch));
+}
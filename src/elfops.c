@@ -7,306 +7,1028 @@
 #define ElfType_Shdr TYPE_NAME(_Shdr, ELF_N)
 #define ElfType_Sym  TYPE_NAME(_Sym,  ELF_N)
 #define ElfType_Off  TYPE_NAME(_Off,  ELF_N)
+#define ElfType_Phdr TYPE_NAME(_Phdr, ELF_N)
+#define ElfType_Dyn  TYPE_NAME(_Dyn,  ELF_N)
+#define ElfType_Addr TYPE_NAME(_Addr, ELF_N)
+#define ElfType_Rel  TYPE_NAME(_Rel,  ELF_N)
+#define ElfType_Rela TYPE_NAME(_Rela, ELF_N)
+// r_info is (symbol << shift) | type
+#define ElfType_R_SHIFT (sizeof(ElfType_Addr) == 8 ? 32 : 8)
 
-int FUNCTION_NAME(findSymtabAndStrtabAndShdr_, ELF_N)(char *objFileName, ElfType_Ehdr ehdr,
+// Every field of the object is read with ELF_GET and written with ELF_SET.
+// ELF_DATA is the byte order this instance handles: when it is the host's
+// the accessors are plain loads and stores, otherwise they swap.
+#if (ELF_DATA == ELFDATA2LSB) == (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define ELF_FOREIGN 0
+#define ELF_GET(x) (x)
+#define ELF_SET(x, v) ((x) = (v))
+#else
+#define ELF_FOREIGN 1
+#define ELF_BSWAP(x)                                                           \
+  ((__typeof__(x))(sizeof(x) == 8   ? __builtin_bswap64(x)                     \
+                   : sizeof(x) == 4 ? __builtin_bswap32(x)                     \
+                   : sizeof(x) == 2 ? __builtin_bswap16(x)                     \
+                                    : (x)))
+#define ELF_GET(x) ELF_BSWAP(x)
+#define ELF_SET(x, v) ((x) = ELF_BSWAP((__typeof__(x))(v)))
+#endif
+
+// With 'dynamic' (or when there is no .symtab) the symbol table is .dynsym
+// and the string table .dynstr.  Everything else 'st' records about the
+// section header table is gathered in the same pass.
+int FUNCTION_NAME(findSymtabAndStrtabAndShdr_, ELF_V)(MappedFile *mf,
                                ElfType_Shdr **shdr, ElfType_Shdr **symtab,
-                               ElfType_Shdr **strtab) {
+                               ElfType_Shdr **strtab, int dynamic,
+                               SectionTable *st) {
   if (debug_func)
     printf("%s\n", __FUNCTION__);
-  unsigned long shoff = ehdr.e_shoff; // Section header table offset
-  unsigned long shnum = ehdr.e_shnum; // Section header num entries
-  *shdr = malloc(sizeof(ElfType_Shdr) *
-                 ehdr.e_shnum); // Copy of section header table entries
-  read_metadata(objFileName, (char *)*shdr, (shnum) * sizeof(ElfType_Shdr),
-                shoff); // read in section headers
+  ElfType_Ehdr *ehdr = (ElfType_Ehdr *)mf->addr;
+  unsigned long shoff = ELF_GET(ehdr->e_shoff); // Section header table offset
+  unsigned long shnum = ELF_GET(ehdr->e_shnum); // Section header num entries
+  unsigned long shstrndx = ELF_GET(ehdr->e_shstrndx);
+  memset(st, 0, sizeof(*st));
+  // Past SHN_LORESERVE sections the count and the index of the section
+  // name table live in section header 0
+  if (shoff != 0 && (shnum == 0 || shstrndx == SHN_XINDEX)) {
+    if (shoff > mf->size || sizeof(ElfType_Shdr) > mf->size - shoff) {
+      fprintf(stderr, "Section header table is outside of %s\n", mf->path);
+      return -1;
+    }
+    ElfType_Shdr *first = (ElfType_Shdr *)(mf->addr + shoff);
+    if (shnum == 0)
+      shnum = ELF_GET(first->sh_size);
+    if (shstrndx == SHN_XINDEX)
+      shstrndx = ELF_GET(first->sh_link);
+  }
+  if (shoff > mf->size || shnum > (mf->size - shoff) / sizeof(ElfType_Shdr)) {
+    fprintf(stderr, "Section header table is outside of %s\n", mf->path);
+    return -1;
+  }
+  *shdr = (ElfType_Shdr *)(mf->addr + shoff); // points into the mapping
+  st->shnum = shnum;
+  st->shstrndx = shstrndx;
 
   ElfType_Shdr *hdr = *shdr;
-  int idx;
+  ElfType_Shdr *dynsym = NULL;
+  ElfType_Shdr *symtabShndx = NULL, *dynsymShndx = NULL;
+  size_t idx;
 
   // Go through the section table entries
   for (idx = 0; idx < shnum; idx++, hdr++) {
-    switch (hdr->sh_type) {
+    switch (ELF_GET(hdr->sh_type)) {
     case SHT_SYMTAB:
-      *symtab = hdr;
-      if (debug)
-        printf("symtab: size=%lu offset=%p\n", hdr->sh_size,
-               (void *)hdr->sh_offset);
-      *strtab = *shdr + hdr->sh_link;
-      if (debug)
-        printf("strtab: size=%lu offset=%p\n", (*strtab)->sh_size,
-               (void *)(*strtab)->sh_offset);
-      assert((*strtab)->sh_type == SHT_STRTAB);
+      if (!dynamic)
+        *symtab = hdr;
       break;
+    case SHT_DYNSYM:
+      dynsym = hdr;
+      break;
+    case SHT_SYMTAB_SHNDX:
+      // Extended section indices of the symbol table it links to
+      if (ELF_GET(hdr->sh_link) >= shnum)
+        break;
+      if (ELF_GET((*shdr)[ELF_GET(hdr->sh_link)].sh_type) == SHT_DYNSYM)
+        dynsymShndx = hdr;
+      else
+        symtabShndx = hdr;
+      break;
+    case SHT_NULL: // section 0 may hold the count in sh_size
+    case SHT_NOBITS:
+      continue;
+    }
+    if (ELF_GET(hdr->sh_offset) + ELF_GET(hdr->sh_size) > st->endOfSections)
+      st->endOfSections = ELF_GET(hdr->sh_offset) + ELF_GET(hdr->sh_size);
+  }
+  // Stripped shared objects and executables only have .dynsym
+  if (*symtab == NULL)
+    *symtab = dynsym;
+  if (*symtab != NULL) {
+    if (ELF_GET((*symtab)->sh_link) >= shnum)
+      return -1;
+    hdr = *symtab == dynsym ? dynsymShndx : symtabShndx;
+    if (hdr != NULL && ELF_GET(hdr->sh_link) == *symtab - *shdr) {
+      size_t nsyms = ELF_GET((*symtab)->sh_size) / sizeof(ElfType_Sym);
+      if (ELF_GET(hdr->sh_offset) > mf->size ||
+          ELF_GET(hdr->sh_size) > mf->size - ELF_GET(hdr->sh_offset) ||
+          ELF_GET(hdr->sh_size) / sizeof(Elf32_Word) < nsyms) {
+        fprintf(stderr, "Extended section index table is outside of %s\n",
+                mf->path);
+        return -1;
+      }
+      st->shndx = hdr - *shdr;
+    }
+    if (debug)
+      printf("symtab: size=%" PRIu64 " offset=%#" PRIx64 "\n",
+             (uint64_t)ELF_GET((*symtab)->sh_size),
+             (uint64_t)ELF_GET((*symtab)->sh_offset));
+    *strtab = *shdr + ELF_GET((*symtab)->sh_link);
+    if (debug)
+      printf("strtab: size=%" PRIu64 " offset=%#" PRIx64 "\n",
+             (uint64_t)ELF_GET((*strtab)->sh_size),
+             (uint64_t)ELF_GET((*strtab)->sh_offset));
+    if (ELF_GET((*strtab)->sh_type) != SHT_STRTAB) {
+      fprintf(stderr, "The symbol table of %s has no string table\n",
+              mf->path);
+      return -1;
     }
   }
   if (*symtab == NULL || *strtab == NULL)
     return -1;
+  if (ELF_GET((*symtab)->sh_offset) > mf->size ||
+      ELF_GET((*symtab)->sh_size) > mf->size - ELF_GET((*symtab)->sh_offset) ||
+      ELF_GET((*strtab)->sh_offset) > mf->size ||
+      ELF_GET((*strtab)->sh_size) > mf->size - ELF_GET((*strtab)->sh_offset)) {
+    fprintf(stderr, "Symbol or string table is outside of %s\n", mf->path);
+    return -1;
+  }
   if (debug)
     printf("%p %p %s\n", *symtab, *strtab,
            "Found Symbol table and String Table");
   return 0;
 }
 
-int FUNCTION_NAME(loopSymbolTableForSymbol_, ELF_N)(int index, char **list, ElfType_Sym *symtab_ent,
-                             unsigned int symtab_size, char *strtab_ent,
-                             FLAGTYPE ft, int *symcountptr) {
+// 'shndx_ent' is the symbol table's SHT_SYMTAB_SHNDX, NULL if it has none
+int FUNCTION_NAME(loopSymbolTableForSymbol_, ELF_V)(ObjCtx *ctx, ElfType_Sym *symtab_ent,
+                             unsigned long symtab_size, char *strtab_ent,
+                             unsigned long strtab_size, Elf32_Word *shndx_ent) {
   if (debug_func)
     printf("%s\n", __FUNCTION__);
-  if (!index)
-    return 0;
+  const RuleSet *rs = ctx->rules;
+  size_t nsyms = symtab_size / sizeof(ElfType_Sym);
   ElfType_Sym *sym = NULL;
 
-  if (ft == SINGLESYM)
-    printf("\t%s\n", "Single Symbols");
-  if (ft == KEEPNUMSYM)
-    printf("\t%s\n", "Keep Number Symbols");
-  if (ft == COMPLETESYM)
-    printf("\t%s\n", "Complete Symbols");
-
-  for (int i = 0; i < index; ++i) {
-    int found = 0;
-    for (sym = symtab_ent; (char *)sym < (char *)symtab_ent + symtab_size;
-         sym++) {
-      if (sym->st_name != 0) {
-        char *symtab_symbol = strtab_ent + sym->st_name;
-        if (strcmp(symtab_symbol, list[i]) == 0) {
-          if ((def_or_undef == ONLY_DEF && sym->st_shndx == SHN_UNDEF) ||
-              (def_or_undef == ONLY_UNDEF && sym->st_shndx != SHN_UNDEF)) {
-            if (verbose)
-              printf("\t\tContinue because of def or undef\n");
-            continue;
-          }
-
-          printf("\t\tsymbol: %s  |  ", strtab_ent + sym->st_name);
-          printf("sym->st_value: %p\n", (void *)sym->st_value);
-          found = 1;
-
-          // Copy into correct (single | keepnum | complete) syms to replace
-          // array
-          switch (ft) {
-          case SINGLESYM:
-            actualSingleSymbolsToReplace[actualSingleSymbolsIndex++] =
-                strdup(symtab_symbol);
-            break;
-          case KEEPNUMSYM:
-            actualKeepNumSymbolsToReplace[actualKeepNumSymbolsIndex++] =
-                strdup(symtab_symbol);
-            break;
-          case COMPLETESYM:
-            actualCompleteSymbolsToReplace[actualCompleteSymbolsIndex++] =
-                strdup(symtab_symbol);
-            break;
-          }
-        }
-      }
+  // One pass over .symtab, looking every name up among the exact rules and
+  // then the pattern automaton; the null name (st_name == 0) never matches
+  for (size_t i = 0; i < nsyms; ++i) {
+    sym = symtab_ent + i;
+    if (ELF_GET(sym->st_name) == 0 || ELF_GET(sym->st_name) >= strtab_size)
+      continue;
+    long rule = ruleset_lookup(rs, strtab_ent + ELF_GET(sym->st_name),
+                               strtab_size - ELF_GET(sym->st_name));
+    if (rule == -1)
+      continue;
+    size_t section = ELF_GET(sym->st_shndx);
+    if (section == SHN_XINDEX && shndx_ent != NULL)
+      section = ELF_GET(shndx_ent[i]);
+    if ((ctx->h->def_or_undef == MES_ONLY_DEF && section == SHN_UNDEF) ||
+        (ctx->h->def_or_undef == MES_ONLY_UNDEF && section != SHN_UNDEF)) {
+      if (ctx->h->logLevel >= MES_LOG_VERBOSE)
+        fprintf(ctx->out, "\t\tContinue because of def or undef\n");
+      continue;
     }
-    if (!found) {
-      if (verbose)
-        printf("\t\t*** ***Could not find: %s\n", list[i]);
-      if (ft == KEEPNUMSYM) {
-        printf("\t\tKeep Number Symbol : (%s) was NOT FOUND. [ERROR]\n",
-               list[i]);
-        return -1;
-      }
-    } else
-      ++(*symcountptr);
+    if (addMatch(ctx, i, rule, strtab_ent + ELF_GET(sym->st_name)) == -1)
+      return -1;
   }
-  if (verbose)
-    printf("\t\tNumber of symbols to replace is: %d\n", *symcountptr);
+
+  // Report in rule order, grouped by kind of rename
+  qsort(ctx->matches, ctx->matchCount, sizeof(Match), compareMatches);
   return 0;
 }
 
-int FUNCTION_NAME(checkIfSymbolsExist_, ELF_N)(char *objFileName, int singleSymbolIndex,
-                        char **singleSymbolList, int keepNumSymbolIndex,
-                        char **keepNumSymbolList, int completeSymbolIndex,
-                        char **completeSymbolList, ElfType_Shdr *symtab,
+int FUNCTION_NAME(checkIfSymbolsExist_, ELF_V)(ObjCtx *ctx, MappedFile *mf,
+                        ElfType_Shdr *shdr, ElfType_Shdr *symtab,
                         ElfType_Shdr *strtab, int *symcountptr) {
   if (debug_func)
     printf("%s\n", __FUNCTION__);
-  ElfType_Sym *sym = NULL;
-  ElfType_Sym *symtab_ent = NULL;
-  char *strtab_ent = NULL;
-
-  symtab_ent = malloc(symtab->sh_size);
+  const RuleSet *rs = ctx->rules;
+  // Both tables are read straight out of the mapping
+  ElfType_Sym *symtab_ent =
+      (ElfType_Sym *)(mf->addr + ELF_GET(symtab->sh_offset));
+  char *strtab_ent = mf->addr + ELF_GET(strtab->sh_offset);
+  Elf32_Word *shndx_ent =
+      ctx->sections.shndx
+          ? (Elf32_Word *)(mf->addr +
+                           ELF_GET(shdr[ctx->sections.shndx].sh_offset))
+          : NULL;
+  static const char *headers[] = {"Single Symbols", "Keep Number Symbols",
+                                  "Complete Symbols"};
   if (debug)
-    printf("symtab: size=%lu offset=%p\n", symtab->sh_size,
-           (void *)symtab->sh_offset);
-  read_metadata(objFileName, (char *)symtab_ent, symtab->sh_size,
-                symtab->sh_offset);
-  strtab_ent = malloc(strtab->sh_size);
+    printf("symtab: size=%" PRIu64 " offset=%#" PRIx64 "\n",
+           (uint64_t)ELF_GET(symtab->sh_size),
+           (uint64_t)ELF_GET(symtab->sh_offset));
   if (debug)
-    printf("strtab: size=%lu offset=%p\n", strtab->sh_size,
-           (void *)strtab->sh_offset);
-  read_metadata(objFileName, strtab_ent, strtab->sh_size, strtab->sh_offset);
+    printf("strtab: size=%" PRIu64 " offset=%#" PRIx64 "\n",
+           (uint64_t)ELF_GET(strtab->sh_size),
+           (uint64_t)ELF_GET(strtab->sh_offset));
+
+  if (ctx->h->logLevel >= MES_LOG_INFO)
+    fprintf(ctx->out, "In file %s %ssymbols checked:\n", mf->path,
+            ELF_GET(symtab->sh_type) == SHT_DYNSYM ? "dynamic " : "");
+  if (FUNCTION_NAME(loopSymbolTableForSymbol_, ELF_V)(
+          ctx, symtab_ent, ELF_GET(symtab->sh_size), strtab_ent,
+          ELF_GET(strtab->sh_size), shndx_ent) == -1)
+    return -1;
 
-  unsigned int symtab_size = symtab->sh_size;
+  char *found = arena_calloc(ctx->scratch, rs->count, 1);
+  if (found == NULL)
+    return -1;
+  int m = 0;
+  for (int ft = SINGLESYM; ft <= COMPLETESYM; ++ft) {
+    if (rs->countByFt[ft] == 0)
+      continue;
+    if (ctx->h->logLevel >= MES_LOG_INFO)
+      fprintf(ctx->out, "\t%s\n", headers[ft]);
+    for (; m < ctx->matchCount && ctx->matches[m].ft == ft; ++m) {
+      ElfType_Sym *sym = symtab_ent + ctx->matches[m].symidx;
+      if (ctx->h->logLevel >= MES_LOG_INFO) {
+        fprintf(ctx->out, "\t\tsymbol: %s  |  ",
+                strtab_ent + ELF_GET(sym->st_name));
+        fprintf(ctx->out, "sym->st_value: %p\n",
+                (void *)(uintptr_t)ELF_GET(sym->st_value));
+      }
+      if (!found[ctx->matches[m].rule]) {
+        found[ctx->matches[m].rule] = 1;
+        ++(*symcountptr);
+      }
+    }
+  }
 
-  printf("In file %s symbols checked:\n", objFileName);
+  int rc = 0;
+  if (ctx->h->logLevel >= MES_LOG_VERBOSE)
+    for (int r = 0; r < rs->count; ++r)
+      if (!found[r])
+        fprintf(ctx->out, "\t\t*** ***Could not find: %s\n", rs->rules[r].name);
+  // Members of an archive each define only part of the library
+  for (int k = 0; k < rs->keepNumCount && !ctx->member; ++k) {
+    if (!found[rs->keepNumRules[k]]) {
+      fprintf(ctx->out, "\t\tKeep Number Symbol : (%s) was NOT FOUND. [ERROR]\n",
+              rs->rules[rs->keepNumRules[k]].name);
+      rc = -1;
+    }
+  }
+  if (ctx->h->logLevel >= MES_LOG_VERBOSE)
+    fprintf(ctx->out, "\t\tNumber of symbols to replace is: %d\n",
+            *symcountptr);
+  return rc;
+}
 
-  // Loop for Single Sym
-  FUNCTION_NAME(loopSymbolTableForSymbol_, ELF_N)(singleSymbolIndex, singleSymbolList, symtab_ent,
-                           symtab_size, strtab_ent, SINGLESYM, symcountptr);
+int FUNCTION_NAME(extendAndFixAfterStrtab_, ELF_V)(MappedFile *mf,
+                            const SectionTable *st, ElfType_Shdr **shdr,
+                            ElfType_Shdr **symtab, ElfType_Shdr **strtab,
+                            int add_space) {
+  if (debug_func)
+    printf("%s\n", __FUNCTION__);
+  if (!mf->writable) {
+    fprintf(stderr, "*** ***%s is read-only, cannot modify it.\n", mf->path);
+    return -1;
+  }
+  ElfType_Ehdr *ehdr = (ElfType_Ehdr *)mf->addr;
+  ElfType_Off begin_next_section =
+      ELF_GET((*strtab)->sh_offset) + ELF_GET((*strtab)->sh_size);
+  ElfType_Off end_of_sections = st->endOfSections; // of the last section
+  size_t symtab_idx = *symtab - *shdr;
+  size_t strtab_idx = *strtab - *shdr;
+  size_t old_size = mf->size;
+  size_t idx = 0;
+  ElfType_Shdr *ptr;
 
-  // Loop for Keep Num Sym
-  if (FUNCTION_NAME(loopSymbolTableForSymbol_, ELF_N)(keepNumSymbolIndex, keepNumSymbolList,
-                               symtab_ent, symtab_size, strtab_ent, KEEPNUMSYM,
-                               symcountptr) == -1) {
+  if (debug)
+    printf("bns:%#" PRIx64 "  eos:%#" PRIx64 "\n",
+           (uint64_t)begin_next_section, (uint64_t)end_of_sections);
+  if (end_of_sections > ELF_GET(ehdr->e_shoff)) {
+    fprintf(stderr, "*** ***Section header table of %s is not at the end.\n",
+            mf->path);
     return -1;
   }
 
-  // Loop for Complete Sym
-  FUNCTION_NAME(loopSymbolTableForSymbol_, ELF_N)(completeSymbolIndex, completeSymbolList, symtab_ent,
-                           symtab_size, strtab_ent, COMPLETESYM, symcountptr);
+  // Grow the file and displace everything after strtab by 'add_space'.
+  // The section header table moves along with the sections.  An output
+  // file written with write_shifted_copy() already has this layout.
+  if (mf->tail_shift == 0) {
+    if (resize_mapped_file(mf, old_size + add_space) == -1)
+      return -1;
+    memmove(mf->addr + begin_next_section + add_space,
+            mf->addr + begin_next_section, old_size - begin_next_section);
+    trace_io(0, old_size - begin_next_section, 0);
+    mark_dirty(mf, mf->addr + begin_next_section,
+               mf->size - begin_next_section);
+  } else if (mf->tail_shift != add_space) {
+    fprintf(stderr, "*** ***%s was laid out for %zu extra bytes, not %d.\n",
+            mf->path, mf->tail_shift, add_space);
+    return -1;
+  }
+  memset(mf->addr + begin_next_section, 0, add_space);
+  mark_dirty(mf, mf->addr + begin_next_section, add_space);
+
+  // The mapping may have moved: refresh every pointer into it
+  ehdr = (ElfType_Ehdr *)mf->addr;
+  // We displaced the section header table
+  ELF_SET(ehdr->e_shoff, ELF_GET(ehdr->e_shoff) + add_space);
+  *shdr = (ElfType_Shdr *)(mf->addr + ELF_GET(ehdr->e_shoff));
+  *symtab = *shdr + symtab_idx;
+  *strtab = *shdr + strtab_idx;
+  ELF_SET((*strtab)->sh_size, ELF_GET((*strtab)->sh_size) + add_space);
+
+  // Fix the section header table in place
+  for (idx = 0, ptr = *shdr; idx < st->shnum; ++idx, ++ptr) {
+    if (ELF_GET(ptr->sh_offset) > ELF_GET((*strtab)->sh_offset))
+      ELF_SET(ptr->sh_offset, ELF_GET(ptr->sh_offset) + add_space);
+  }
+  mark_dirty(mf, ehdr, sizeof(*ehdr));
+  mark_dirty(mf, *shdr, st->shnum * sizeof(ElfType_Shdr));
+
   return 0;
 }
 
-int FUNCTION_NAME(extendAndFixAfterStrtab_, ELF_N)(char *objFileName, ElfType_Ehdr *ehdr,
+// Instead of growing strtab where it is, copy it to the end of the file
+// and grow it there.  Nothing else in the file moves; the old copy is left
+// behind as unreferenced bytes.
+int FUNCTION_NAME(relocateStrtabToEnd_, ELF_V)(MappedFile *mf,
                             ElfType_Shdr **shdr, ElfType_Shdr **symtab,
-                            ElfType_Shdr **strtab, int add_space) {
+                            ElfType_Shdr **strtab, size_t added) {
   if (debug_func)
     printf("%s\n", __FUNCTION__);
-  ElfType_Off begin_next_section = (*strtab)->sh_offset + (*strtab)->sh_size;
-  ElfType_Off end_of_sections = (*strtab)->sh_offset + (*strtab)->sh_size;
+  size_t symtab_idx = *symtab - *shdr;
+  size_t strtab_idx = *strtab - *shdr;
+  ElfType_Off old_offset = ELF_GET((*strtab)->sh_offset);
+  ElfType_Off old_size = ELF_GET((*strtab)->sh_size);
+  unsigned long align = ELF_GET((*strtab)->sh_addralign) > 1
+                            ? ELF_GET((*strtab)->sh_addralign)
+                            : 1;
+  ElfType_Off new_offset = (mf->size + align - 1) / align * align;
+
+  if (resize_mapped_file(mf, new_offset + old_size + added) == -1)
+    return -1;
+  memcpy(mf->addr + new_offset, mf->addr + old_offset, old_size);
+  trace_io(0, old_size, 0);
 
-  ehdr->e_shoff += add_space; // We will be displacing section header table
-  (*strtab)->sh_size += add_space;
+  // The mapping may have moved: refresh every pointer into it
+  ElfType_Ehdr *ehdr = (ElfType_Ehdr *)mf->addr;
+  *shdr = (ElfType_Shdr *)(mf->addr + ELF_GET(ehdr->e_shoff));
+  *symtab = *shdr + symtab_idx;
+  *strtab = *shdr + strtab_idx;
+  ELF_SET((*strtab)->sh_offset, new_offset);
+  ELF_SET((*strtab)->sh_size, old_size + added);
+  mark_dirty(mf, mf->addr + new_offset, old_size);
+  mark_dirty(mf, *strtab, sizeof(ElfType_Shdr));
+  return 0;
+}
 
-  if (debug)
-    printf("bns:%p  eos:%p\n", (void *)begin_next_section,
-           (void *)end_of_sections);
-
-  // Modify Section Header Table and write back
-  int idx = 0;
-  ElfType_Shdr *ptr = *shdr;
-  for (; idx < ehdr->e_shnum; ++idx, ++ptr) {
-    ElfType_Shdr tmpshdr = *ptr;
-    if (tmpshdr.sh_offset > (*strtab)->sh_offset) {
-      ptr->sh_offset += add_space;
+// .dynstr is part of the loaded image, so it cannot grow where it is.
+// Copy it, grown, into a new read-only PT_LOAD at the end of the file and
+// point .dynamic and its section header at the copy.  The program header
+// table needs one more entry, so it moves into the new segment as well.
+// The segment is placed so that vaddr - offset is the same as for the
+// first PT_LOAD, past the end of everything already mapped.
+int FUNCTION_NAME(relocateDynstrToSegment_, ELF_V)(MappedFile *mf,
+                            ElfType_Shdr **shdr, ElfType_Shdr **symtab,
+                            ElfType_Shdr **strtab, size_t added) {
+  if (debug_func)
+    printf("%s\n", __FUNCTION__);
+  ElfType_Ehdr *ehdr = (ElfType_Ehdr *)mf->addr;
+  size_t symtab_idx = *symtab - *shdr;
+  size_t strtab_idx = *strtab - *shdr;
+  ElfType_Off old_offset = ELF_GET((*strtab)->sh_offset);
+  ElfType_Off old_size = ELF_GET((*strtab)->sh_size);
+  size_t phnum = ELF_GET(ehdr->e_phnum);
+
+  if (ELF_GET(ehdr->e_phoff) == 0 || phnum == 0 || phnum + 1 >= PN_XNUM ||
+      ELF_GET(ehdr->e_phoff) > mf->size ||
+      phnum * sizeof(ElfType_Phdr) > mf->size - ELF_GET(ehdr->e_phoff)) {
+    fprintf(stderr, "*** ***%s has no usable program header table.\n",
+            mf->path);
+    return -1;
+  }
+  ElfType_Phdr *phdr = (ElfType_Phdr *)(mf->addr + ELF_GET(ehdr->e_phoff));
+  ElfType_Phdr *first = NULL;
+  size_t last_load = 0;
+  ElfType_Off dyn_offset = 0, dyn_size = 0;
+  unsigned long vend = 0, align = 0x1000;
+  for (size_t i = 0; i < phnum; ++i) {
+    if (ELF_GET(phdr[i].p_type) == PT_LOAD) {
+      if (first == NULL)
+        first = &phdr[i];
+      last_load = i;
+      if (ELF_GET(phdr[i].p_vaddr) + ELF_GET(phdr[i].p_memsz) > vend)
+        vend = ELF_GET(phdr[i].p_vaddr) + ELF_GET(phdr[i].p_memsz);
+      if (ELF_GET(phdr[i].p_align) > align)
+        align = ELF_GET(phdr[i].p_align);
+    } else if (ELF_GET(phdr[i].p_type) == PT_DYNAMIC) {
+      dyn_offset = ELF_GET(phdr[i].p_offset);
+      dyn_size = ELF_GET(phdr[i].p_filesz);
     }
-    if (tmpshdr.sh_offset + tmpshdr.sh_size >
-        end_of_sections) { // End of section header
-      end_of_sections = tmpshdr.sh_offset + tmpshdr.sh_size;
+  }
+  if (first == NULL || dyn_size == 0 || dyn_offset > mf->size ||
+      dyn_size > mf->size - dyn_offset) {
+    fprintf(stderr, "*** ***%s has no PT_LOAD or PT_DYNAMIC segment.\n",
+            mf->path);
+    return -1;
+  }
+  unsigned long base = ELF_GET(first->p_vaddr) - ELF_GET(first->p_offset);
+
+  // New segment: program headers, then .dynstr
+  ElfType_Off seg_offset = (mf->size + align - 1) / align * align;
+  if (vend - base > seg_offset)
+    seg_offset = (vend - base + align - 1) / align * align;
+  size_t phsize = (phnum + 1) * sizeof(ElfType_Phdr);
+  ElfType_Off new_offset = seg_offset + (phsize + 7) / 8 * 8;
+  size_t new_size = old_size + added;
+
+  if (resize_mapped_file(mf, new_offset + new_size) == -1)
+    return -1;
+
+  // The mapping may have moved: refresh every pointer into it
+  ehdr = (ElfType_Ehdr *)mf->addr;
+  phdr = (ElfType_Phdr *)(mf->addr + ELF_GET(ehdr->e_phoff));
+  ElfType_Phdr *new_phdr = (ElfType_Phdr *)(mf->addr + seg_offset);
+  memcpy(new_phdr, phdr, (last_load + 1) * sizeof(ElfType_Phdr));
+  memcpy(new_phdr + last_load + 2, phdr + last_load + 1,
+         (phnum - last_load - 1) * sizeof(ElfType_Phdr));
+  ElfType_Phdr *load = new_phdr + last_load + 1; // keeps PT_LOADs sorted
+  memset(load, 0, sizeof(*load));
+  ELF_SET(load->p_type, PT_LOAD);
+  ELF_SET(load->p_flags, PF_R);
+  ELF_SET(load->p_offset, seg_offset);
+  ELF_SET(load->p_vaddr, base + seg_offset);
+  ELF_SET(load->p_paddr, base + seg_offset);
+  ELF_SET(load->p_filesz, new_offset + new_size - seg_offset);
+  ELF_SET(load->p_memsz, new_offset + new_size - seg_offset);
+  ELF_SET(load->p_align, align);
+  for (size_t i = 0; i <= phnum; ++i) {
+    if (ELF_GET(new_phdr[i].p_type) != PT_PHDR)
+      continue;
+    ELF_SET(new_phdr[i].p_offset, seg_offset);
+    ELF_SET(new_phdr[i].p_vaddr, base + seg_offset);
+    ELF_SET(new_phdr[i].p_paddr, base + seg_offset);
+    ELF_SET(new_phdr[i].p_filesz, phsize);
+    ELF_SET(new_phdr[i].p_memsz, phsize);
+  }
+  ELF_SET(ehdr->e_phoff, seg_offset);
+  ELF_SET(ehdr->e_phnum, phnum + 1);
+
+  memcpy(mf->addr + new_offset, mf->addr + old_offset, old_size);
+  trace_io(0, phsize + old_size, 0);
+  for (ElfType_Dyn *dyn = (ElfType_Dyn *)(mf->addr + dyn_offset);
+       (char *)(dyn + 1) <= mf->addr + dyn_offset + dyn_size &&
+       ELF_GET(dyn->d_tag) != DT_NULL;
+       ++dyn) {
+    if (ELF_GET(dyn->d_tag) == DT_STRTAB)
+      ELF_SET(dyn->d_un.d_ptr, base + new_offset);
+    else if (ELF_GET(dyn->d_tag) == DT_STRSZ)
+      ELF_SET(dyn->d_un.d_val, new_size);
+  }
+
+  *shdr = (ElfType_Shdr *)(mf->addr + ELF_GET(ehdr->e_shoff));
+  *symtab = *shdr + symtab_idx;
+  *strtab = *shdr + strtab_idx;
+  ELF_SET((*strtab)->sh_offset, new_offset);
+  ELF_SET((*strtab)->sh_addr, base + new_offset);
+  ELF_SET((*strtab)->sh_size, new_size);
+  mark_dirty(mf, ehdr, sizeof(*ehdr));
+  mark_dirty(mf, new_phdr, phsize);
+  mark_dirty(mf, mf->addr + new_offset, old_size);
+  mark_dirty(mf, mf->addr + dyn_offset, dyn_size);
+  mark_dirty(mf, *strtab, sizeof(ElfType_Shdr));
+  return 0;
+}
+
+// Every offset into strtab that something in the object refers to, sorted.
+// Returns 1 if strtab may be referenced in ways we do not track.
+int FUNCTION_NAME(collectStrtabRefs_, ELF_V)(MappedFile *mf,
+                                             const SectionTable *st,
+                                             ElfType_Shdr *shdr,
+                                             ElfType_Shdr *symtab,
+                                             ElfType_Shdr *strtab, Arena *arena,
+                                             unsigned long **refs,
+                                             size_t *nrefs) {
+  size_t strtab_idx = strtab - shdr;
+  size_t nsyms = ELF_GET(symtab->sh_size) / sizeof(ElfType_Sym);
+  ElfType_Sym *symtab_ent =
+      (ElfType_Sym *)(mf->addr + ELF_GET(symtab->sh_offset));
+  int shared_shstrtab = st->shstrndx == strtab_idx;
+  size_t n = 0;
+
+  for (size_t idx = 0; idx < st->shnum; ++idx)
+    if (shdr + idx != symtab && ELF_GET(shdr[idx].sh_link) == strtab_idx &&
+        ELF_GET(shdr[idx].sh_type) != SHT_NULL)
+      return 1;
+
+  size_t max = nsyms + (shared_shstrtab ? st->shnum : 0);
+  *refs = arena_alloc(arena, max * sizeof(unsigned long));
+  if (*refs == NULL)
+    return -1;
+  for (size_t i = 0; i < nsyms; ++i)
+    if (ELF_GET(symtab_ent[i].st_name) != 0)
+      (*refs)[n++] = ELF_GET(symtab_ent[i].st_name);
+  if (shared_shstrtab)
+    for (size_t idx = 0; idx < st->shnum; ++idx)
+      if (ELF_GET(shdr[idx].sh_name) != 0)
+        (*refs)[n++] = ELF_GET(shdr[idx].sh_name);
+  qsort(*refs, n, sizeof(unsigned long), compareOffsets);
+  *nrefs = n;
+  return 0;
+}
+
+// Decide where every new name goes: back into its old slot when it fits
+// there (no file growth at all), else interned at the end of strtab
+int FUNCTION_NAME(planStrtab_, ELF_V)(ObjCtx *ctx, MappedFile *mf,
+                                      ElfType_Shdr *shdr, ElfType_Shdr *symtab,
+                                      ElfType_Shdr *strtab, StrtabBuilder *sb) {
+  if (debug_func)
+    printf("%s\n", __FUNCTION__);
+  ElfType_Sym *symtab_ent =
+      (ElfType_Sym *)(mf->addr + ELF_GET(symtab->sh_offset));
+  char *strtab_buf = mf->addr + ELF_GET(strtab->sh_offset);
+  int n = ctx->planCount;
+  unsigned long *refs = NULL;
+  size_t nrefs = 0;
+
+  unsigned long *oldStName = arena_alloc(ctx->scratch, n * sizeof(long));
+  unsigned long *skip = arena_alloc(ctx->scratch, n * sizeof(long));
+  char **names = arena_alloc(ctx->scratch, n * sizeof(char *));
+  unsigned long *offsets = arena_alloc(ctx->scratch, n * sizeof(long));
+  if (!oldStName || !skip || !names || !offsets)
+    return -1;
+  for (int i = 0; i < n; ++i)
+    oldStName[i] = ELF_GET(symtab_ent[ctx->planSymIdx[i]].st_name);
+
+  int refstate = FUNCTION_NAME(collectStrtabRefs_, ELF_V)(
+      mf, &ctx->sections, shdr, symtab, strtab, ctx->scratch, &refs, &nrefs);
+  if (refstate == -1)
+    return -1;
+  if (refstate == 0 &&
+      markInPlaceRenames(ctx, strtab_buf, ELF_GET(strtab->sh_size), refs, nrefs,
+                         oldStName) == -1)
+    return -1;
+
+  // Intern whatever could not be renamed in place
+  size_t nskip = 0, nnames = 0;
+  for (int i = 0; i < n; ++i) {
+    if (ctx->planInPlace[i])
+      skip[nskip++] = ctx->planStName[i];
+    else
+      names[nnames++] = ctx->planNewName[i];
+  }
+  qsort(skip, nskip, sizeof(unsigned long), compareOffsets);
+  if (strtab_builder_init(sb, ctx->scratch, strtab_buf,
+                          ELF_GET(strtab->sh_size), names, nnames, skip,
+                          nskip) == -1 ||
+      strtab_intern_all(sb, names, nnames, offsets) == -1)
+    return -1;
+  for (int i = 0, k = 0; i < n; ++i)
+    if (!ctx->planInPlace[i])
+      ctx->planStName[i] = offsets[k++];
+  if (ctx->h->logLevel >= MES_LOG_VERBOSE)
+    fprintf(ctx->out, "\t\t%zu rename(s) in place, %zu new string byte(s)\n",
+            nskip, sb->added_len);
+  return 0;
+}
+
+int FUNCTION_NAME(addSymbolsAndUpdateSymtab_, ELF_V)(ObjCtx *ctx, MappedFile *mf,
+                              ElfType_Shdr *symtab, ElfType_Shdr *strtab,
+                              unsigned long prev_strtab_size,
+                              StrtabBuilder *sb) {
+  if (debug_func)
+    printf("%s\n", __FUNCTION__);
+  // From planRenames() and strtab_intern_all() we know which symbols to
+  // rewrite and where each new name lives; only the new bytes are copied
+  ElfType_Sym *symtab_ent =
+      (ElfType_Sym *)(mf->addr + ELF_GET(symtab->sh_offset));
+  char *strtab_buf = mf->addr + ELF_GET(strtab->sh_offset);
+
+  if (prev_strtab_size + sb->added_len > ELF_GET(strtab->sh_size))
+    return -1;
+  memcpy(strtab_buf + prev_strtab_size, sb->added, sb->added_len);
+  trace_io(0, sb->added_len + ctx->planCount * sizeof(symtab_ent->st_name), 0);
+  mark_dirty(mf, strtab_buf + prev_strtab_size, sb->added_len);
+
+  for (int i = 0; i < ctx->planCount; ++i) {
+    if (ctx->planInPlace[i]) {
+      // Overwrite the old name and clear what is left of it
+      char *slot = strtab_buf + ctx->planStName[i];
+      size_t oldlen = strnlen(slot, prev_strtab_size - ctx->planStName[i]);
+      memset(slot, 0, oldlen);
+      memcpy(slot, ctx->planNewName[i], strlen(ctx->planNewName[i]));
+      mark_dirty(mf, slot, oldlen);
     }
+    ELF_SET(symtab_ent[ctx->planSymIdx[i]].st_name, ctx->planStName[i]);
+    mark_dirty(mf, &symtab_ent[ctx->planSymIdx[i]].st_name,
+               sizeof(symtab_ent->st_name));
     if (debug)
-      printf("bns:%p  eos:%p ptr:%p\n", (void *)begin_next_section,
-             (void *)end_of_sections, ptr);
+      printf("NEW STRING IS **** %s **** at %lu\n", ctx->planNewName[i],
+             ctx->planStName[i]);
   }
   if (debug)
-    printf("bns:%p  eos:%p\n", (void *)begin_next_section,
-           (void *)end_of_sections);
+    printf("strtab->sh_size = %" PRIu64 " : added = %zu\n",
+           (uint64_t)ELF_GET(strtab->sh_size), sb->added_len);
 
-  // Displace all sections after strtab by 'add_space'.
-  assert(end_of_sections <= ehdr->e_shoff);
-  if (end_of_sections > begin_next_section) {
-    if (debug)
-      printf("start of if: %s\n",  __FUNCTION__);
-    char tmpbuf[end_of_sections - begin_next_section];
-    read_metadata(objFileName, tmpbuf, sizeof(tmpbuf), begin_next_section);
-    // read_metadata(objFileName, tmpbuf, end_of_sections - begin_next_section,
-    // begin_next_section);
-    if (debug)
-      printf("middle of if: between read_metadata and write_metadata %s\n",
-	     __FUNCTION__);
-    write_metadata(objFileName, tmpbuf, sizeof(tmpbuf),
-                   begin_next_section + add_space);
-    if (debug)
-      printf("end of if: %s\n", __FUNCTION__);
+  return 0;
+}
+
+// Point every relocation against .dynsym at the symbols' new indices
+void FUNCTION_NAME(remapRelocations_, ELF_V)(MappedFile *mf, ElfType_Shdr *shdr,
+                                             size_t shnum, size_t dynsym_idx,
+                                             size_t nsyms,
+                                             const uint32_t *newidx) {
+  unsigned shift = ElfType_R_SHIFT;
+  ElfType_Addr typemask = ((ElfType_Addr)1 << shift) - 1;
+
+  for (size_t idx = 0; idx < shnum; ++idx) {
+    size_t entsize;
+    if (ELF_GET(shdr[idx].sh_link) != dynsym_idx)
+      continue;
+    if (ELF_GET(shdr[idx].sh_type) == SHT_REL)
+      entsize = sizeof(ElfType_Rel);
+    else if (ELF_GET(shdr[idx].sh_type) == SHT_RELA)
+      entsize = sizeof(ElfType_Rela);
+    else
+      continue;
+    if (ELF_GET(shdr[idx].sh_offset) > mf->size ||
+        ELF_GET(shdr[idx].sh_size) > mf->size - ELF_GET(shdr[idx].sh_offset))
+      continue;
+    // r_info is at the same place in Rel and Rela
+    char *table = mf->addr + ELF_GET(shdr[idx].sh_offset);
+    for (size_t off = 0; off + entsize <= ELF_GET(shdr[idx].sh_size);
+         off += entsize) {
+      ElfType_Rel *rel = (ElfType_Rel *)(table + off);
+      ElfType_Addr sym = ELF_GET(rel->r_info) >> shift;
+      if (sym < nsyms)
+        ELF_SET(rel->r_info, ((ElfType_Addr)newidx[sym] << shift) |
+                                 (ELF_GET(rel->r_info) & typemask));
+    }
+    mark_dirty(mf, table, ELF_GET(shdr[idx].sh_size));
+  }
+}
+
+// The hash tables are keyed by name, so renamed dynamic symbols have to be
+// rehashed.  Both tables are rebuilt at their current size.  DT_GNU_HASH
+// wants the hashed symbols grouped by bucket, so those are re-sorted and
+// everything indexed by symbol number (.gnu.version, SHT_SYMTAB_SHNDX and
+// the relocations) follows them.
+int FUNCTION_NAME(rehashDynsym_, ELF_V)(ObjCtx *ctx, MappedFile *mf,
+                                        ElfType_Shdr *shdr,
+                                        ElfType_Shdr *dynsym,
+                                        ElfType_Shdr *dynstr) {
+  if (debug_func)
+    printf("%s\n", __FUNCTION__);
+  ElfType_Sym *syms = (ElfType_Sym *)(mf->addr + ELF_GET(dynsym->sh_offset));
+  const char *names = mf->addr + ELF_GET(dynstr->sh_offset);
+  size_t nsyms = ELF_GET(dynsym->sh_size) / sizeof(ElfType_Sym);
+  size_t dynsym_idx = dynsym - shdr;
+  ElfType_Shdr *gnuhash = NULL, *hash = NULL, *versym = NULL, *shndx = NULL;
+
+  for (size_t idx = 0; idx < ctx->sections.shnum; ++idx) {
+    if (ELF_GET(shdr[idx].sh_link) != dynsym_idx ||
+        ELF_GET(shdr[idx].sh_offset) > mf->size ||
+        ELF_GET(shdr[idx].sh_size) > mf->size - ELF_GET(shdr[idx].sh_offset))
+      continue;
+    switch (ELF_GET(shdr[idx].sh_type)) {
+    case SHT_GNU_HASH:
+      gnuhash = &shdr[idx];
+      break;
+    case SHT_HASH:
+      hash = &shdr[idx];
+      break;
+    case SHT_GNU_versym:
+      versym = &shdr[idx];
+      break;
+    case SHT_SYMTAB_SHNDX:
+      shndx = &shdr[idx];
+      break;
+    }
   }
+#define DYNSYM_NAME(i)                                                         \
+  (ELF_GET(syms[i].st_name) < ELF_GET(dynstr->sh_size)                        \
+       ? names + ELF_GET(syms[i].st_name)                                      \
+       : "")
+
+  if (gnuhash) {
+    uint32_t *hdr = (uint32_t *)(mf->addr + ELF_GET(gnuhash->sh_offset));
+    if (ELF_GET(gnuhash->sh_size) < 4 * sizeof(uint32_t))
+      goto bad_gnuhash;
+    uint32_t nbuckets = ELF_GET(hdr[0]), symoffset = ELF_GET(hdr[1]);
+    uint32_t bloom_size = ELF_GET(hdr[2]), bloom_shift = ELF_GET(hdr[3]);
+    size_t bits = 8 * sizeof(ElfType_Addr);
+    ElfType_Addr *bloom = (ElfType_Addr *)(hdr + 4);
+    uint32_t *buckets = (uint32_t *)(bloom + bloom_size);
+    uint32_t *chains = buckets + nbuckets;
+    if (nbuckets == 0 || bloom_size == 0 ||
+        (bloom_size & (bloom_size - 1)) != 0 || symoffset > nsyms ||
+        ELF_GET(gnuhash->sh_size) <
+            4 * sizeof(uint32_t) + bloom_size * sizeof(ElfType_Addr) +
+                (nbuckets + nsyms - symoffset) * sizeof(uint32_t))
+      goto bad_gnuhash;
+
+    size_t n = nsyms - symoffset;
+    size_t before = 0, after = 0, moved = 0;
+    uint32_t *h = arena_alloc(ctx->scratch, n * sizeof(uint32_t));
+    uint32_t *order = arena_alloc(ctx->scratch, n * sizeof(uint32_t));
+    uint32_t *newidx = arena_alloc(ctx->scratch, nsyms * sizeof(uint32_t));
+    size_t *start = arena_calloc(ctx->scratch, nbuckets + 1, sizeof(size_t));
+    if (!h || !order || !newidx || !start)
+      return -1;
+    for (uint32_t w = 0; w < bloom_size; ++w)
+      before += __builtin_popcountll(bloom[w]);
 
-  // Write back section headers and ELF header
-  write_metadata(objFileName, (char *)*shdr,
-                 (ehdr->e_shnum) * sizeof(ElfType_Shdr), ehdr->e_shoff);
-  write_metadata(objFileName, (char *)ehdr, sizeof(ElfType_Ehdr), 0);
+    // Stable counting sort of the hashed symbols by bucket
+    for (size_t i = 0; i < n; ++i) {
+      h[i] = elf_gnu_hash(DYNSYM_NAME(symoffset + i));
+      start[h[i] % nbuckets + 1]++;
+    }
+    for (uint32_t b = 0; b < nbuckets; ++b)
+      start[b + 1] += start[b];
+    for (size_t i = 0; i < n; ++i)
+      order[start[h[i] % nbuckets]++] = i;
+    for (size_t i = 0; i < symoffset; ++i)
+      newidx[i] = i;
+    for (size_t k = 0; k < n; ++k) {
+      newidx[symoffset + order[k]] = symoffset + k;
+      moved += order[k] != k;
+    }
 
+    if (moved) {
+      ElfType_Sym *tmp = arena_alloc(ctx->scratch, n * sizeof(ElfType_Sym));
+      uint32_t *tmp32 = arena_alloc(ctx->scratch, n * sizeof(uint32_t));
+      if (!tmp || !tmp32)
+        return -1;
+      memcpy(tmp, syms + symoffset, n * sizeof(ElfType_Sym));
+      for (size_t k = 0; k < n; ++k)
+        syms[symoffset + k] = tmp[order[k]];
+      mark_dirty(mf, syms + symoffset, n * sizeof(ElfType_Sym));
+      if (versym && ELF_GET(versym->sh_size) >= nsyms * sizeof(uint16_t)) {
+        uint16_t *ver =
+            (uint16_t *)(mf->addr + ELF_GET(versym->sh_offset)) + symoffset;
+        uint16_t *tmp16 = (uint16_t *)tmp; // big enough
+        memcpy(tmp16, ver, n * sizeof(uint16_t));
+        for (size_t k = 0; k < n; ++k)
+          ver[k] = tmp16[order[k]];
+        mark_dirty(mf, ver, n * sizeof(uint16_t));
+      }
+      if (shndx && ELF_GET(shndx->sh_size) >= nsyms * sizeof(uint32_t)) {
+        uint32_t *ext =
+            (uint32_t *)(mf->addr + ELF_GET(shndx->sh_offset)) + symoffset;
+        memcpy(tmp32, ext, n * sizeof(uint32_t));
+        for (size_t k = 0; k < n; ++k)
+          ext[k] = tmp32[order[k]];
+        mark_dirty(mf, ext, n * sizeof(uint32_t));
+      }
+      FUNCTION_NAME(remapRelocations_, ELF_V)(mf, shdr, ctx->sections.shnum,
+                                              dynsym_idx, nsyms, newidx);
+    }
+
+    memset(bloom, 0, bloom_size * sizeof(ElfType_Addr));
+    memset(buckets, 0, nbuckets * sizeof(uint32_t));
+    for (size_t k = 0; k < n; ++k) {
+      uint32_t hv = h[order[k]];
+      uint32_t b = hv % nbuckets;
+      bloom[(hv / bits) & (bloom_size - 1)] |=
+          ((ElfType_Addr)1 << (hv % bits)) |
+          ((ElfType_Addr)1 << ((hv >> bloom_shift) % bits));
+      if (buckets[b] == 0)
+        buckets[b] = symoffset + k;
+      chains[k] = hv & ~1u;
+      if (k + 1 == n || h[order[k + 1]] % nbuckets != b)
+        chains[k] |= 1; // last of its bucket
+    }
+#if ELF_FOREIGN
+    // Built in host order above, stored in the object's
+    for (uint32_t w = 0; w < bloom_size; ++w)
+      bloom[w] = ELF_BSWAP(bloom[w]);
+    for (size_t i = 0; i < nbuckets + n; ++i)
+      buckets[i] = ELF_BSWAP(buckets[i]);
+#endif
+    mark_dirty(mf, hdr, ELF_GET(gnuhash->sh_size));
+    for (uint32_t w = 0; w < bloom_size; ++w)
+      after += __builtin_popcountll(bloom[w]);
+    if (ctx->h->logLevel >= MES_LOG_INFO)
+      fprintf(ctx->out,
+              "\t\t.gnu.hash rebuilt: %zu symbol(s) reordered, bloom %zu/%zu "
+              "bits set before, %zu/%zu after\n",
+              moved, before, (size_t)bloom_size * bits, after,
+              (size_t)bloom_size * bits);
+  }
+
+  // A .hash with 64 bit entries (s390x, alpha) or whose counts do not
+  // match .dynsym is left as it is; the renames still go ahead, and
+  // .gnu.hash, which the dynamic linker prefers, is rebuilt all the same
+  if (hash) {
+    uint32_t *hdr = (uint32_t *)(mf->addr + ELF_GET(hash->sh_offset));
+    if (ELF_GET(hash->sh_entsize) != 4 ||
+        ELF_GET(hash->sh_size) < 2 * sizeof(uint32_t) ||
+        ELF_GET(hdr[0]) == 0 || ELF_GET(hdr[1]) != nsyms ||
+        ELF_GET(hash->sh_size) <
+            (2 + (size_t)ELF_GET(hdr[0]) + nsyms) * sizeof(uint32_t)) {
+      if (ctx->h->logLevel >= MES_LOG_INFO)
+        fprintf(ctx->out,
+                "\t\t.hash layout not supported, left as it was%s\n",
+                gnuhash ? "" : ": lookups through it miss renamed symbols");
+      hash = NULL;
+    }
+  }
+  if (hash) {
+    uint32_t *hdr = (uint32_t *)(mf->addr + ELF_GET(hash->sh_offset));
+    uint32_t nbucket = ELF_GET(hdr[0]);
+    uint32_t *bucket = hdr + 2;
+    uint32_t *chain = bucket + nbucket;
+    memset(bucket, 0, (nbucket + nsyms) * sizeof(uint32_t));
+    for (size_t i = nsyms; i-- > 1;) {
+      uint32_t b = elf_sysv_hash(DYNSYM_NAME(i)) % nbucket;
+      chain[i] = bucket[b];
+      bucket[b] = i;
+    }
+#if ELF_FOREIGN
+    for (size_t i = 0; i < nbucket + nsyms; ++i)
+      bucket[i] = ELF_BSWAP(bucket[i]);
+#endif
+    mark_dirty(mf, hdr, ELF_GET(hash->sh_size));
+    if (ctx->h->logLevel >= MES_LOG_VERBOSE)
+      fprintf(ctx->out, "\t\t.hash rebuilt: %u bucket(s)\n", nbucket);
+  }
+#undef DYNSYM_NAME
   return 0;
+
+bad_gnuhash:
+  fprintf(ctx->out, "\t\t*** ***Unsupported .gnu.hash layout, not rebuilt\n");
+  return -1;
 }
 
-int FUNCTION_NAME(addSymbolsAndUpdateSymtab_, ELF_N)(char *objFileName, int num, int index,
-                              char **list, ElfType_Shdr *symtab,
-                              ElfType_Shdr *strtab,
-                              unsigned long *prev_strtab_size, char *str,
-                              FLAGTYPE ft) {
+// Growth of strtab rounded so that no section after it loses its alignment
+int FUNCTION_NAME(alignedStrtabGrowth_, ELF_V)(const SectionTable *st,
+                                               ElfType_Shdr *shdr,
+                                               ElfType_Shdr *strtab,
+                                               size_t added) {
+  unsigned long align = sizeof(ElfType_Off); // keeps e_shoff aligned
+  if (added == 0)
+    return 0;
+  for (size_t idx = 0; idx < st->shnum; ++idx)
+    if (ELF_GET(shdr[idx].sh_offset) > ELF_GET(strtab->sh_offset) &&
+        ELF_GET(shdr[idx].sh_addralign) > align)
+      align = ELF_GET(shdr[idx].sh_addralign);
+  return (added + align - 1) / align * align;
+}
+
+int FUNCTION_NAME(processObject_, ELF_V)(ObjCtx *ctx, MappedFile *mf) {
   if (debug_func)
     printf("%s\n", __FUNCTION__);
-  if (index < 1)
-    return 0;
-  // From previous function checkIfSymbolsExist_Elf<N>(), we know all the symbols exist
+  ElfType_Shdr *shdr = NULL;
+  ElfType_Shdr *symtab = NULL;
+  ElfType_Shdr *strtab = NULL;
+  unsigned long prev_strtab_size = 0;
+  TraceSpan span;
 
-  int numSymbolsToChange = index;
-  unsigned int symtab_size = symtab->sh_size;
+  // Find symbol table and string table
+  //   - shdr points into the mapping
+  trace_begin(&span, TRACE_FIND_TABLES);
+  int found = FUNCTION_NAME(findSymtabAndStrtabAndShdr_, ELF_V)(
+      mf, &shdr, &symtab, &strtab, ctx->h->dynamicSymbols, &ctx->sections);
+  trace_end(&span, ctx->num);
+  if (found == -1)
+    return -1;
+  prev_strtab_size = ELF_GET(strtab->sh_size);
 
-  ElfType_Sym *sym = NULL;
-  char symtab_buf[symtab->sh_size];
-  char strtab_buf[strtab->sh_size];
-  char numbuf[300] = {0};
-  memset(numbuf, 0, sizeof(numbuf));
-  sprintf(numbuf, "%d", num + 1);
-
-  read_metadata(objFileName, symtab_buf, symtab->sh_size, symtab->sh_offset);
-  read_metadata(objFileName, strtab_buf, strtab->sh_size, strtab->sh_offset);
-
-  for (int i = 0; i < numSymbolsToChange; ++i) {
-    for (sym = (void *)symtab_buf;
-         (char *)sym < (char *)symtab_buf + symtab->sh_size; sym++) {
-      if (sym->st_name != 0) {
-
-        char *symtab_symbol = strtab_buf + sym->st_name;
-
-        if (strcmp(symtab_symbol, list[i]) == 0) {
-          int newStringSize = 0;
-          char newString[300] = {0};
-
-          memset(newString, 0, sizeof(newString));
-
-          sym->st_name = *prev_strtab_size;
-
-          switch (ft) {
-          case SINGLESYM:
-            strcat(newString, list[i]);
-            if (str) {
-              strcat(newString, str);
-            } else {
-              strcat(newString, "__dmtcp_plt");
-            }
-            break;
-          case KEEPNUMSYM:
-            strcat(newString, list[i]);
-            if (str) {
-              strcat(newString, str);
-            } else {
-              strcat(newString, "__dmtcp_");
-            }
-            strcat(newString, numbuf);
-            break;
-          case COMPLETESYM:
-            strcat(newString, str);
-            break;
-          default:
-            break;
-          }
-          strcat(newString, "\0");
-          strncpy((char *)strtab_buf + *prev_strtab_size, newString,
-                  strlen(newString) + 1);
-          *prev_strtab_size += strlen(newString) + 1;
-
-          if (debug)
-            printf("NEW STRING IS **** %s ****\n", newString);
-        }
-      }
+  // Check if the symbols exist first..
+  int symcount = 0;
+  trace_begin(&span, TRACE_CHECK_SYMBOLS);
+  found = FUNCTION_NAME(checkIfSymbolsExist_, ELF_V)(ctx, mf, shdr, symtab,
+                                                     strtab, &symcount);
+  trace_end(&span, ctx->num);
+  if (found == -1)
+    return -1;
+  if (!symcount) {
+    if (ctx->h->logLevel >= MES_LOG_INFO)
+      fprintf(ctx->out, "        ^ ^ ^ continue\n\n");
+    // An atomic commit of an unchanged object has nothing to rename
+    if (ctx->outFileName && !modifiesInPlace(ctx) &&
+        !stopBeforeWriting(ctx)) {
+      trace_begin(&span, TRACE_COPY);
+      found = write_shifted_copy(mf, ctx->outFileName, 0, 0,
+                                 ctx->commitTarget != NULL);
+      trace_end(&span, ctx->num);
+      ctx->outWritten = found != -1;
+      return found;
     }
-    if (debug)
-      printf("strtab->sh_size = %lu : prev = %lu\n", strtab->sh_size,
-             *prev_strtab_size);
+    return 0;
   }
 
-  // Pad out with '\0'
-  for (int i = *prev_strtab_size; i < strtab->sh_size; ++i)
-    strtab_buf[i] = '\0';
+  // Work out the new names; rename in place where they fit, intern the
+  // rest into strtab
+  StrtabBuilder sb;
+  trace_begin(&span, TRACE_PLAN_STRTAB);
+  if (planRenames(ctx) == -1)
+    return -1;
+  if (FUNCTION_NAME(planStrtab_, ELF_V)(ctx, mf, shdr, symtab, strtab, &sb) ==
+      -1)
+    return -1;
+  trace_end(&span, ctx->num);
+  // Nothing has been written yet; a stopped run leaves the object alone
+  if (stopBeforeWriting(ctx))
+    return 0;
+  ctx->bytesAdded += sb.added_len;
+
+  // Extend the string table and whatever follows after..
+  // Fix Elf header and Section header Table
+  // With --strtab-at-end, relocatable objects get a new strtab at the end
+  // of the file instead, so nothing has to be displaced; a growing .dynstr
+  // always goes to a new segment at the end
+  int dynamic = ELF_GET(symtab->sh_type) == SHT_DYNSYM;
+  int rel = ELF_GET(((ElfType_Ehdr *)mf->addr)->e_type) == ET_REL;
+  int relocate = sb.added_len > 0 && (dynamic || (ctx->h->strtabAtEnd && rel));
+  int add_space = relocate ? 0
+                           : FUNCTION_NAME(alignedStrtabGrowth_, ELF_V)(
+                                 &ctx->sections, shdr, strtab, sb.added_len);
+  if (debug)
+    printf("ADD_SPACE is: %x\n", add_space);
 
-  write_metadata(objFileName, (char *)symtab_buf, symtab->sh_size,
-                 symtab->sh_offset);
-  write_metadata(objFileName, (char *)strtab_buf, strtab->sh_size,
-                 strtab->sh_offset);
+  if (ctx->outFileName) {
+    // Out of place: clone the input into the output with the bytes after
+    // strtab already displaced, then edit only the tables in the output.
+    size_t symtab_idx = symtab - shdr;
+    size_t strtab_idx = strtab - shdr;
+    ElfType_Off split = ELF_GET(strtab->sh_offset) + ELF_GET(strtab->sh_size);
+    ElfType_Off shoff = ELF_GET(((ElfType_Ehdr *)mf->addr)->e_shoff);
+    if (shoff >= split)
+      shoff += add_space;
+    trace_begin(&span, TRACE_COPY);
+    if (write_shifted_copy(mf, ctx->outFileName, split, add_space,
+                           ctx->commitTarget != NULL) == -1)
+      return -1;
+    ctx->outWritten = 1;
+    unmap_file(mf);
+    if (map_file(ctx->outFileName, mf, 1, ctx->h->io_buffered) == -1)
+      return -1;
+    mf->ring = writeRing(ctx->h);
+    trace_end(&span, ctx->num);
+    mf->tail_shift = add_space;
+    shdr = (ElfType_Shdr *)(mf->addr + shoff);
+    symtab = shdr + symtab_idx;
+    strtab = shdr + strtab_idx;
+  }
+
+  // Relocating the table counts as making room for the new names too
+  int rc = 0;
+  trace_begin(&span, TRACE_EXTEND);
+  if (relocate && dynamic)
+    rc = FUNCTION_NAME(relocateDynstrToSegment_, ELF_V)(mf, &shdr, &symtab,
+                                                        &strtab, sb.added_len);
+  else if (relocate)
+    rc = FUNCTION_NAME(relocateStrtabToEnd_, ELF_V)(mf, &shdr, &symtab,
+                                                    &strtab, sb.added_len);
+  else if (add_space > 0)
+    rc = FUNCTION_NAME(extendAndFixAfterStrtab_, ELF_V)(
+        mf, &ctx->sections, &shdr, &symtab, &strtab, add_space);
+  if (relocate || add_space > 0)
+    trace_end(&span, ctx->num);
 
+  // Add the new symbol name(s) and update symtab
+  if (rc != -1) {
+    trace_begin(&span, TRACE_UPDATE);
+    rc = FUNCTION_NAME(addSymbolsAndUpdateSymtab_, ELF_V)(
+        ctx, mf, symtab, strtab, prev_strtab_size, &sb);
+    trace_end(&span, ctx->num);
+  }
+
+  // ld.so looks dynamic symbols up by hash
+  if (rc != -1 && dynamic) {
+    trace_begin(&span, TRACE_REHASH);
+    rc = FUNCTION_NAME(rehashDynsym_, ELF_V)(ctx, mf, shdr, symtab, strtab);
+    trace_end(&span, ctx->num);
+  }
+
+  return rc;
+}
+
+// Names an archive index lists for this member: global, weak and unique
+// symbols that the member defines
+int FUNCTION_NAME(armapSymbols_, ELF_V)(MappedFile *mf, Arena *arena,
+                                        StrList *names) {
+  if (debug_func)
+    printf("%s\n", __FUNCTION__);
+  ElfType_Shdr *shdr = NULL;
+  ElfType_Shdr *symtab = NULL;
+  ElfType_Shdr *strtab = NULL;
+  SectionTable st;
+  if (FUNCTION_NAME(findSymtabAndStrtabAndShdr_, ELF_V)(mf, &shdr, &symtab,
+                                                        &strtab, 0, &st) == -1)
+    return 0; // nothing to index
+  ElfType_Sym *sym = (ElfType_Sym *)(mf->addr + ELF_GET(symtab->sh_offset));
+  char *strtab_ent = mf->addr + ELF_GET(strtab->sh_offset);
+  size_t nsyms = ELF_GET(symtab->sh_size) / sizeof(ElfType_Sym);
+
+  for (size_t i = 1; i < nsyms; ++i) {
+    int bind = ELF64_ST_BIND(ELF_GET(sym[i].st_info)); // same for ELF32
+    if (bind != STB_GLOBAL && bind != STB_WEAK && bind != STB_GNU_UNIQUE)
+      continue;
+    if (ELF_GET(sym[i].st_shndx) == SHN_UNDEF || ELF_GET(sym[i].st_name) == 0 ||
+        ELF_GET(sym[i].st_name) >= ELF_GET(strtab->sh_size))
+      continue;
+    const char *name = strtab_ent + ELF_GET(sym[i].st_name);
+    if (strnlen(name, ELF_GET(strtab->sh_size) - ELF_GET(sym[i].st_name)) ==
+        ELF_GET(strtab->sh_size) - ELF_GET(sym[i].st_name))
+      continue; // runs off the end of .strtab
+    if (strlist_push(arena, names, name) == -1)
+      return -1;
+  }
   return 0;
 }
+
+const ElfOps FUNCTION_NAME(elfOps_, ELF_V) = {
+    FUNCTION_NAME(processObject_, ELF_V),
+    FUNCTION_NAME(armapSymbols_, ELF_V)};
+
+#undef ELF_N
+#undef ELF_V
+#undef ELF_DATA
+#undef ELF_FOREIGN
+#undef ELF_GET
+#undef ELF_SET
+#undef ELF_BSWAP
@@ -0,0 +1,511 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../include/ioring.h"
+#include "../include/trace.h"
+
+// Largest single read or write: the length of an sqe is 32 bits
+#define RING_CHUNK (1UL << 30)
+// Most objects read ahead at a time
+#define RING_MAX_DEPTH 4096
+
+// What a completion is for, in the low bits of its user_data; the rest is
+// the object number or the WriteReq
+enum { OP_OPEN = 0, OP_STATX, OP_READ, OP_WRITE, OP_MASK = 3 };
+
+// The queues shared with the kernel
+typedef struct {
+  int fd;
+  unsigned entries;
+  unsigned cqEntries;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned *cqHead, *cqTail, *cqMask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sqRing, *cqRing;
+  size_t sqLen, cqLen, sqesLen;
+  unsigned queued;   // sqes not handed to the kernel yet
+  unsigned inflight; // handed over, completion not reaped yet
+} Ring;
+
+typedef enum {
+  PF_IDLE = 0, // not started
+  PF_OPEN,     // waiting for the open and the statx
+  PF_READ,     // being read
+  PF_READY,    // in memory, waiting for its worker
+  PF_WARM,     // posix_fadvise() was called on it
+  PF_FAILED,   // its worker maps it the usual way and reports the error
+  PF_TAKEN     // handed over or skipped
+} PFSTATE;
+
+// One object being read ahead
+typedef struct {
+  PFSTATE state;
+  char *path;
+  int writable;
+  int fd;      // -1 until opened
+  int waiting; // open and statx completions still to come
+  int failed;  // one of them failed
+  struct statx stx;
+  char *addr;
+  size_t size;
+  size_t done; // bytes read so far
+} Prefetch;
+
+// One range of a writeback
+typedef struct {
+  MappedFile *mf;
+  int *pending; // ranges of the writeback not written yet
+  int *failed;
+  off_t off;
+  size_t len;
+} WriteReq;
+
+// The read-ahead of one run.  Its workers share the ring; everything is
+// under 'lock'.
+struct IoRing {
+  pthread_mutex_t lock;
+  IORINGBACKEND backend;
+  Ring ring;
+  Prefetch *items;
+  int itemCount, depth;
+  int nextItem; // next object to start reading ahead
+  int ahead;    // objects started and not taken yet
+  ioring_file_fn fileFn;
+  void *fileArg;
+  long prefetchedCount, enterCalls;
+  int broken; // io_uring_enter failed for good: nothing completes
+};
+
+static void complete(IoRing *r, struct io_uring_cqe *cqe);
+static void release(Prefetch *pf);
+
+static int ring_setup(Ring *ring, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (ring->fd == -1)
+    return -1;
+  ring->entries = p.sq_entries;
+  ring->cqEntries = p.cq_entries;
+  ring->sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cqLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqRing = mmap(NULL, ring->sqLen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cqRing = mmap(NULL, ring->cqLen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqesLen, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED ||
+      ring->sqes == MAP_FAILED) {
+    if (ring->sqRing != MAP_FAILED)
+      munmap(ring->sqRing, ring->sqLen);
+    if (ring->cqRing != MAP_FAILED)
+      munmap(ring->cqRing, ring->cqLen);
+    if (ring->sqes != MAP_FAILED)
+      munmap(ring->sqes, ring->sqesLen);
+    close(ring->fd);
+    return -1;
+  }
+  char *sq = ring->sqRing, *cq = ring->cqRing;
+  ring->sqHead = (unsigned *)(sq + p.sq_off.head);
+  ring->sqTail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)(sq + p.sq_off.array);
+  ring->cqHead = (unsigned *)(cq + p.cq_off.head);
+  ring->cqTail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  trace_io(0, 0, 4);
+  return 0;
+}
+
+static void ring_free(Ring *ring) {
+  munmap(ring->sqRing, ring->sqLen);
+  munmap(ring->cqRing, ring->cqLen);
+  munmap(ring->sqes, ring->sqesLen);
+  close(ring->fd);
+  trace_io(0, 0, 4);
+}
+
+// The ring cannot be used any more.  Objects still being read are mapped
+// by their workers instead, their buffers are left to the kernel; the
+// writebacks waiting on it fail.
+static void ring_break(IoRing *r) {
+  r->broken = 1;
+  for (int i = 0; i < r->itemCount; ++i) {
+    Prefetch *pf = &r->items[i];
+    if (pf->state == PF_OPEN || pf->state == PF_READ) {
+      pf->addr = NULL;
+      release(pf);
+      pf->state = PF_FAILED;
+    }
+  }
+}
+
+// Hand the queued sqes to the kernel and wait for 'wait' completions
+static void ring_enter(IoRing *r, unsigned wait) {
+  for (;;) {
+    int rc = syscall(__NR_io_uring_enter, r->ring.fd, r->ring.queued, wait,
+                     wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    trace_io(0, 0, 1);
+    r->enterCalls++;
+    if (rc >= 0) {
+      r->ring.queued -= rc;
+      r->ring.inflight += rc;
+      return;
+    }
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      perror("io_uring_enter");
+      ring_break(r);
+      return;
+    }
+  }
+}
+
+// Wait for at least one completion and handle all that are there
+static void ring_wait(IoRing *r) {
+  Ring *ring = &r->ring;
+  ring_enter(r, 1);
+  if (r->broken)
+    return;
+  unsigned head = *ring->cqHead;
+  while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe cqe = ring->cqes[head & *ring->cqMask];
+    __atomic_store_n(ring->cqHead, ++head, __ATOMIC_RELEASE);
+    ring->inflight--;
+    complete(r, &cqe);
+  }
+}
+
+// Queue a copy of 'sqe'.  A full ring is drained a little first; the
+// completion queue is kept from overflowing as well.  Dropped when the
+// ring is broken.
+static void ring_push(IoRing *r, const struct io_uring_sqe *sqe) {
+  Ring *ring = &r->ring;
+  while (!r->broken &&
+         (*ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) ==
+              ring->entries ||
+          ring->inflight + ring->queued >= ring->cqEntries))
+    ring_wait(r);
+  if (r->broken)
+    return;
+  unsigned tail = *ring->sqTail;
+  unsigned idx = tail & *ring->sqMask;
+  ring->sqes[idx] = *sqe;
+  ring->sqArray[idx] = idx;
+  __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+}
+
+static void release(Prefetch *pf) {
+  if (pf->addr)
+    munmap(pf->addr, pf->size);
+  if (pf->fd != -1)
+    close(pf->fd);
+  trace_io(0, 0, (pf->addr != NULL) + (pf->fd != -1));
+  pf->addr = NULL;
+  pf->fd = -1;
+}
+
+static void queue_read(IoRing *r, int item) {
+  Prefetch *pf = &r->items[item];
+  size_t len = pf->size - pf->done;
+  struct io_uring_sqe sqe = {0};
+  sqe.opcode = IORING_OP_READ;
+  sqe.fd = pf->fd;
+  sqe.addr = (uintptr_t)(pf->addr + pf->done);
+  sqe.len = len < RING_CHUNK ? len : RING_CHUNK;
+  sqe.off = pf->done;
+  sqe.user_data = (uint64_t)item << 2 | OP_READ;
+  ring_push(r, &sqe);
+}
+
+// Open and stat object 'item' at once; reading starts when both are done
+static void start(IoRing *r, int item) {
+  Prefetch *pf = &r->items[item];
+  pf->path = r->fileFn(item, r->fileArg, &pf->writable);
+  if (r->backend == IORING_FADVISE) {
+    int fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+    trace_io(0, 0, 1);
+    if (fd != -1) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+      close(fd);
+      trace_io(0, 0, 2);
+    }
+    pf->state = PF_WARM;
+    return;
+  }
+  pf->waiting = 2;
+  pf->state = PF_OPEN;
+  struct io_uring_sqe sqe = {0};
+  sqe.opcode = IORING_OP_OPENAT;
+  sqe.fd = AT_FDCWD;
+  sqe.addr = (uintptr_t)pf->path;
+  sqe.open_flags = (pf->writable ? O_RDWR : O_RDONLY) | O_CLOEXEC;
+  sqe.user_data = (uint64_t)item << 2 | OP_OPEN;
+  ring_push(r, &sqe);
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = IORING_OP_STATX;
+  sqe.fd = AT_FDCWD;
+  sqe.addr = (uintptr_t)pf->path;
+  sqe.len = STATX_TYPE | STATX_MODE | STATX_SIZE;
+  sqe.off = (uintptr_t)&pf->stx;
+  sqe.user_data = (uint64_t)item << 2 | OP_STATX;
+  ring_push(r, &sqe);
+}
+
+static void write_done(IoRing *r, WriteReq *req, int res) {
+  if (res > 0 && (size_t)res < req->len) {
+    // Short write: the rest goes out again
+    trace_io(0, res, 0);
+    req->off += res;
+    req->len -= res;
+    struct io_uring_sqe sqe = {0};
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = req->mf->fd;
+    sqe.addr = (uintptr_t)(req->mf->addr + req->off);
+    sqe.len = req->len;
+    sqe.off = req->off;
+    sqe.user_data = (uintptr_t)req | OP_WRITE;
+    ring_push(r, &sqe);
+    return;
+  }
+  if (res <= 0) {
+    fprintf(stderr, "ioring_write: %s: %s\n", req->mf->path,
+           res ? strerror(-res) : "nothing written");
+    *req->failed = 1;
+  } else {
+    trace_io(0, res, 0);
+  }
+  --*req->pending;
+}
+
+static void complete(IoRing *r, struct io_uring_cqe *cqe) {
+  int op = cqe->user_data & OP_MASK;
+  if (op == OP_WRITE) {
+    write_done(r,
+               (WriteReq *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK),
+               cqe->res);
+    return;
+  }
+  int item = cqe->user_data >> 2;
+  Prefetch *pf = &r->items[item];
+  if (op == OP_READ) {
+    if (cqe->res <= 0) {
+      // Its worker reads it again and reports the error
+      release(pf);
+      pf->state = PF_FAILED;
+      return;
+    }
+    trace_io(cqe->res, 0, 0);
+    pf->done += cqe->res;
+    if (pf->done < pf->size)
+      queue_read(r, item);
+    else
+      pf->state = PF_READY;
+    return;
+  }
+
+  if (op == OP_OPEN && cqe->res >= 0)
+    pf->fd = cqe->res;
+  else if (cqe->res < 0 ||
+           (op == OP_STATX &&
+            (!S_ISREG(pf->stx.stx_mode) || pf->stx.stx_size == 0)))
+    pf->failed = 1;
+  if (--pf->waiting > 0)
+    return;
+  if (!pf->failed) {
+    pf->size = pf->stx.stx_size;
+    pf->addr = mmap(NULL, pf->size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    trace_io(0, 0, 1);
+    if (pf->addr == MAP_FAILED) {
+      pf->addr = NULL;
+      pf->failed = 1;
+    }
+  }
+  if (pf->failed) {
+    release(pf);
+    pf->state = PF_FAILED;
+    return;
+  }
+  pf->state = PF_READ;
+  queue_read(r, item);
+}
+
+// Keep 'depth' objects read ahead of the workers
+static void top_up(IoRing *r) {
+  while (r->ahead < r->depth && r->nextItem < r->itemCount && !r->broken) {
+    int item = r->nextItem++;
+    if (r->items[item].state != PF_IDLE)
+      continue;
+    start(r, item);
+    r->ahead++;
+  }
+  if (r->backend == IORING_URING && r->ring.queued && !r->broken)
+    ring_enter(r, 0);
+}
+
+// Start reading ahead 'count' objects with 'backend'.  Without io_uring
+// this falls back to posix_fadvise(); ioring_backend() tells which one is
+// used.  NULL when there is nothing to read ahead.
+IoRing *ioring_start(IORINGBACKEND backend, int count, int depth,
+                     ioring_file_fn file, void *arg) {
+  if (backend == IORING_OFF || depth < 1 || count == 0)
+    return NULL;
+  if (depth > RING_MAX_DEPTH)
+    depth = RING_MAX_DEPTH;
+  IoRing *r = calloc(1, sizeof(IoRing));
+  Prefetch *items = calloc(count, sizeof(Prefetch));
+  if (r == NULL || items == NULL) {
+    perror("ioring_start");
+    free(items);
+    free(r);
+    return NULL;
+  }
+  if (backend == IORING_URING && ring_setup(&r->ring, 2 * depth + 16) == -1)
+    backend = IORING_FADVISE;
+  for (int i = 0; i < count; ++i)
+    items[i].fd = -1;
+  pthread_mutex_init(&r->lock, NULL);
+  r->backend = backend;
+  r->items = items;
+  r->itemCount = count;
+  r->depth = depth;
+  r->fileFn = file;
+  r->fileArg = arg;
+  return r;
+}
+
+IORINGBACKEND ioring_backend(const IoRing *r) {
+  return r ? r->backend : IORING_OFF;
+}
+
+// Done with object 'item': its read-ahead is handed over in 'mf', or
+// dropped when 'mf' is NULL
+static int finish(IoRing *r, int item, MappedFile *mf) {
+  Prefetch *pf = &r->items[item];
+  int rc = 1;
+  pthread_mutex_lock(&r->lock);
+  if (pf->state == PF_IDLE)
+    pf->state = PF_TAKEN; // not worth starting now
+  top_up(r);
+  while (pf->state == PF_OPEN || pf->state == PF_READ)
+    ring_wait(r);
+  if (pf->state == PF_READY && mf) {
+    memset(mf, 0, sizeof(*mf));
+    mf->path = pf->path;
+    mf->fd = pf->fd;
+    mf->addr = pf->addr;
+    mf->size = pf->size;
+    mf->writable = pf->writable;
+    mf->mode = pf->stx.stx_mode;
+    mf->buffered = 1;
+    mf->ring = r;
+    mf->disk_size = pf->size;
+    pf->fd = -1;
+    pf->addr = NULL;
+    r->prefetchedCount++;
+    rc = 0;
+  }
+  release(pf);
+  if (pf->state != PF_TAKEN) {
+    pf->state = PF_TAKEN;
+    r->ahead--;
+    top_up(r);
+  }
+  pthread_mutex_unlock(&r->lock);
+  return rc;
+}
+
+// Hand object 'item' over as a buffered MappedFile, opened and read in
+// the background.  1 when it was not read ahead: map_file() it instead.
+int ioring_take(IoRing *r, int item, MappedFile *mf) {
+  if (r == NULL)
+    return 1;
+  return finish(r, item, mf);
+}
+
+// Object 'item' is not going to be read after all
+void ioring_skip(IoRing *r, int item) {
+  if (r != NULL)
+    finish(r, item, NULL);
+}
+
+// Write 'count' ranges of buffered 'mf' back through its ring mf->ring,
+// all submitted at once.  'calls' is increased by the io_uring_enter calls
+// that took.
+int ioring_write(MappedFile *mf, const Extent *extents, int count,
+                 int *calls) {
+  IoRing *r = mf->ring;
+  int n = 0, pending = 0, failed = 0;
+  for (int i = 0; i < count; ++i)
+    n += (extents[i].len + RING_CHUNK - 1) / RING_CHUNK;
+  WriteReq *reqs = malloc((n ? n : 1) * sizeof(WriteReq));
+  if (reqs == NULL) {
+    perror("ioring_write");
+    return -1;
+  }
+  pthread_mutex_lock(&r->lock);
+  long before = r->enterCalls;
+  for (int i = 0, q = 0; i < count; ++i) {
+    for (size_t done = 0; done < extents[i].len; done += RING_CHUNK, ++q) {
+      size_t len = extents[i].len - done;
+      WriteReq *req = &reqs[q];
+      *req = (WriteReq){mf, &pending, &failed, extents[i].off + done,
+                        len < RING_CHUNK ? len : RING_CHUNK};
+      struct io_uring_sqe sqe = {0};
+      sqe.opcode = IORING_OP_WRITE;
+      sqe.fd = mf->fd;
+      sqe.addr = (uintptr_t)(mf->addr + req->off);
+      sqe.len = req->len;
+      sqe.off = req->off;
+      sqe.user_data = (uintptr_t)req | OP_WRITE;
+      ring_push(r, &sqe);
+      pending++;
+    }
+  }
+  while (pending && !r->broken)
+    ring_wait(r);
+  if (r->broken)
+    failed = 1;
+  *calls += r->enterCalls - before;
+  pthread_mutex_unlock(&r->lock);
+  free(reqs);
+  return failed ? -1 : 0;
+}
+
+// Wait for whatever is still in flight and free it all, 'r' included;
+// 'prefetched' gets the objects that were handed over, 'calls' the
+// io_uring_enter calls
+void ioring_stop(IoRing *r, long *prefetched, long *calls) {
+  *prefetched = *calls = 0;
+  if (r == NULL)
+    return;
+  if (r->backend == IORING_URING)
+    while ((r->ring.inflight || r->ring.queued) && !r->broken)
+      ring_wait(r);
+  *prefetched = r->prefetchedCount;
+  *calls = r->enterCalls;
+  for (int i = 0; i < r->itemCount; ++i)
+    release(&r->items[i]);
+  if (r->backend == IORING_URING)
+    ring_free(&r->ring);
+  pthread_mutex_destroy(&r->lock);
+  free(r->items);
+  free(r);
+}
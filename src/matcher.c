@@ -0,0 +1,260 @@
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/matcher.h"
+
+int matcher_add(Matcher *m, MATCHTYPE type, const char *pattern, int id) {
+  if (m->count == m->cap) {
+    int cap = m->cap ? m->cap * 2 : 16;
+    MatcherPattern *patterns = realloc(m->patterns, cap * sizeof(*patterns));
+    if (patterns == NULL) {
+      perror("matcher_add");
+      return -1;
+    }
+    m->patterns = patterns;
+    m->cap = cap;
+  }
+  MatcherPattern *p = &m->patterns[m->count++];
+  p->type = type;
+  p->pattern = pattern;
+  p->len = strlen(pattern);
+  p->id = id;
+  p->nextAtNode = -1;
+  return 0;
+}
+
+// Longest run of a glob that has to appear literally in any matching name
+static const char *glob_literal(const char *glob, size_t *len,
+                                char *buf) {
+  size_t best = 0, cur = 0;
+  const char *best_start = buf;
+  char *run = buf;
+  for (const char *g = glob; *g; ++g) {
+    if (*g == '*' || *g == '?' || *g == '[') {
+      if (*g == '[') {
+        while (g[1] && g[1] != ']')
+          ++g;
+        if (g[1] == ']')
+          ++g;
+      }
+      run += cur + 1;
+      cur = 0;
+      continue;
+    }
+    if (*g == '\\' && g[1])
+      ++g;
+    run[cur++] = *g;
+    if (cur > best) {
+      best = cur;
+      best_start = run;
+    }
+  }
+  *len = best;
+  return best_start;
+}
+
+static int matcher_new_node(Matcher *m) {
+  if (m->nodes == m->nodeCap) {
+    int cap = m->nodeCap ? m->nodeCap * 2 : 64;
+    int *next = realloc(m->next, (size_t)cap * m->classes * sizeof(int));
+    if (next)
+      m->next = next;
+    int *out = realloc(m->out, cap * sizeof(int));
+    if (out)
+      m->out = out;
+    int *dict = realloc(m->dict, cap * sizeof(int));
+    if (dict)
+      m->dict = dict;
+    if (!next || !out || !dict) {
+      perror("matcher_new_node");
+      return -1;
+    }
+    m->nodeCap = cap;
+  }
+  int node = m->nodes++;
+  for (int c = 0; c < m->classes; ++c)
+    m->next[(size_t)node * m->classes + c] = -1;
+  m->out[node] = -1;
+  m->dict[node] = -1;
+  return node;
+}
+
+// The literal fed to the automaton for pattern 'p'; a glob's is copied to
+// a buffer of its own, returned in 'buf' to be freed
+static const char *pattern_literal(const MatcherPattern *p, size_t *len,
+                                   char **buf) {
+  *buf = NULL;
+  *len = p->len;
+  if (p->type != MATCH_GLOB)
+    return p->pattern;
+  *buf = malloc(p->len + 1);
+  if (*buf == NULL)
+    return NULL;
+  return glob_literal(p->pattern, len, *buf);
+}
+
+int matcher_compile(Matcher *m) {
+  m->nodes = 0;
+  m->alwaysCount = 0;
+  m->always = malloc((m->count ? m->count : 1) * sizeof(int));
+  if (m->always == NULL)
+    return -1;
+
+  // The alphabet: one class per byte that appears in some literal
+  memset(m->classOf, 0, sizeof(m->classOf));
+  m->classes = 1;
+  for (int i = 0; i < m->count; ++i) {
+    size_t len;
+    char *buf;
+    const char *lit = pattern_literal(&m->patterns[i], &len, &buf);
+    if (lit == NULL)
+      return -1;
+    for (size_t k = 0; k < len; ++k)
+      if (m->classOf[(unsigned char)lit[k]] == 0)
+        m->classOf[(unsigned char)lit[k]] = m->classes++;
+    free(buf);
+  }
+  if (matcher_new_node(m) == -1)
+    return -1;
+
+  // Trie of all literals
+  for (int i = 0; i < m->count; ++i) {
+    MatcherPattern *p = &m->patterns[i];
+    size_t len;
+    char *buf;
+    const char *lit = pattern_literal(p, &len, &buf);
+    if (lit == NULL)
+      return -1;
+    if (len == 0) {
+      m->always[m->alwaysCount++] = i;
+      free(buf);
+      continue;
+    }
+    int node = 0;
+    for (size_t k = 0; k < len; ++k) {
+      size_t c = m->classOf[(unsigned char)lit[k]];
+      int *slot = &m->next[(size_t)node * m->classes + c];
+      if (*slot == -1) {
+        int child = matcher_new_node(m);
+        if (child == -1) {
+          free(buf);
+          return -1;
+        }
+        // matcher_new_node() may have moved the table
+        slot = &m->next[(size_t)node * m->classes + c];
+        *slot = child;
+      }
+      node = *slot;
+    }
+    p->len = len;
+    p->nextAtNode = m->out[node];
+    m->out[node] = i;
+    free(buf);
+  }
+
+  // Breadth first: failure links, folded straight into the transitions
+  int *fail = malloc(m->nodes * sizeof(int));
+  int *queue = malloc(m->nodes * sizeof(int));
+  if (fail == NULL || queue == NULL) {
+    free(fail);
+    free(queue);
+    return -1;
+  }
+  int head = 0, tail = 0;
+  fail[0] = 0;
+  for (int c = 0; c < m->classes; ++c) {
+    int *slot = &m->next[c];
+    if (*slot == -1) {
+      *slot = 0;
+    } else {
+      fail[*slot] = 0;
+      queue[tail++] = *slot;
+    }
+  }
+  while (head < tail) {
+    int u = queue[head++];
+    int f = fail[u];
+    m->dict[u] = m->out[f] != -1 ? f : m->dict[f];
+    for (int c = 0; c < m->classes; ++c) {
+      int *slot = &m->next[(size_t)u * m->classes + c];
+      if (*slot == -1) {
+        *slot = m->next[(size_t)f * m->classes + c];
+      } else {
+        fail[*slot] = m->next[(size_t)f * m->classes + c];
+        queue[tail++] = *slot;
+      }
+    }
+  }
+  free(fail);
+  free(queue);
+  return 0;
+}
+
+// Smallest id among the patterns matching 'name', -1 if none does
+int matcher_match(const Matcher *m, const char *name, size_t maxlen) {
+  int best = -1;
+  int candidates[32];
+  int ncandidates = 0;
+  int overflow = 0; // more globs hit than 'candidates' holds
+  int state = 0;
+  size_t i;
+
+  if (m->count == 0)
+    return -1;
+  for (i = 0; i < maxlen && name[i] != '\0'; ++i) {
+    state = m->next[(size_t)state * m->classes +
+                    m->classOf[(unsigned char)name[i]]];
+    int node = m->out[state] != -1 ? state : m->dict[state];
+    for (; node != -1; node = m->dict[node]) {
+      for (int k = m->out[node]; k != -1; k = m->patterns[k].nextAtNode) {
+        const MatcherPattern *p = &m->patterns[k];
+        if (best != -1 && p->id >= best)
+          continue;
+        if (p->type == MATCH_PREFIX && i + 1 == p->len)
+          best = p->id;
+        else if (p->type == MATCH_GLOB && ncandidates < 32)
+          candidates[ncandidates++] = k;
+        else if (p->type == MATCH_GLOB)
+          overflow = 1;
+      }
+    }
+  }
+  if (i == maxlen)
+    return -1; // not NUL terminated
+
+  // Whatever ends at the last character is a suffix of the name
+  for (int node = m->out[state] != -1 ? state : m->dict[state]; node != -1;
+       node = m->dict[node])
+    for (int k = m->out[node]; k != -1; k = m->patterns[k].nextAtNode)
+      if (m->patterns[k].type == MATCH_SUFFIX &&
+          (best == -1 || m->patterns[k].id < best))
+        best = m->patterns[k].id;
+
+  // Globs only run once the name is known to end within 'maxlen'.  When
+  // too many were hit to remember, every glob is tried.
+  for (int c = 0; c < (overflow ? m->count : ncandidates); ++c) {
+    const MatcherPattern *p = &m->patterns[overflow ? c : candidates[c]];
+    if (p->type == MATCH_GLOB && (best == -1 || p->id < best) &&
+        fnmatch(p->pattern, name, 0) == 0)
+      best = p->id;
+  }
+  for (int a = 0; a < m->alwaysCount; ++a) {
+    const MatcherPattern *p = &m->patterns[m->always[a]];
+    if (best != -1 && p->id >= best)
+      continue;
+    if (p->type != MATCH_GLOB || fnmatch(p->pattern, name, 0) == 0)
+      best = p->id;
+  }
+  return best;
+}
+
+void matcher_free(Matcher *m) {
+  free(m->patterns);
+  free(m->always);
+  free(m->next);
+  free(m->out);
+  free(m->dict);
+  memset(m, 0, sizeof(*m));
+}
@@ -1,51 +1,86 @@
+#define _GNU_SOURCE
 // elf..
 #include <elf.h>
 
-// write, getopt..
-#include <getopt.h>
+// write..
+#include <errno.h>
 #include <unistd.h>
 
 // printf..
+#include <inttypes.h>
 #include <stdio.h>
 
-// exit..
+// malloc..
 #include <stdlib.h>
 
-// assert
-#include <assert.h>
-
 // c strings..
 #include <string.h>
 
 // for open..
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+// the library interface
+#include "../include/modelfsymbol.h"
+
 // utilities
+#include "../include/archive.h"
+#include "../include/cache.h"
+#include "../include/commit.h"
+#include "../include/ioring.h"
+#include "../include/rules.h"
+#include "../include/strtab.h"
+#include "../include/symindex.h"
+#include "../include/trace.h"
 #include "../include/util.h"
-
-// MACROS
-#define c_print(x) write(1, x, strlen(x))
+#include "../include/workpool.h"
 
 // CONST
-const int debug = 0;
-const int debug_func = 0;
-
-// ENUMERATION
-typedef enum { SINGLESYM = 0, KEEPNUMSYM, COMPLETESYM } FLAGTYPE;
-
-typedef enum { BOTH_DEF_AND_UNDEF = 0, ONLY_DEF, ONLY_UNDEF } REPLACETYPE;
-
-static REPLACETYPE def_or_undef = BOTH_DEF_AND_UNDEF;
-static int verbose = 0;
-
-static char *actualSingleSymbolsToReplace[300] = {0};
-static int actualSingleSymbolsIndex = 0;
-static char *actualKeepNumSymbolsToReplace[300] = {0};
-static int actualKeepNumSymbolsIndex = 0;
-static char *actualCompleteSymbolsToReplace[300] = {0};
-static int actualCompleteSymbolsIndex = 0;
+static const int debug = 0;
+static const int debug_func = 0;
+
+// The library's enumerations are the engine's
+_Static_assert((int)MES_APPEND == SINGLESYM && (int)MES_NUMBER == KEEPNUMSYM &&
+                   (int)MES_RENAME == COMPLETESYM,
+               "MESRULE and FLAGTYPE differ");
+_Static_assert((int)MES_MATCH_PREFIX == MATCH_PREFIX &&
+                   (int)MES_MATCH_SUFFIX == MATCH_SUFFIX &&
+                   (int)MES_MATCH_GLOB == MATCH_GLOB,
+               "MESMATCH and MATCHTYPE differ");
+
+// A rule set, compiled by the first run that uses it
+struct MesRules {
+  RuleSet rs;
+  int finished; // compiled: no more rules can be added
+  int lines;    // added with mes_rules_add_line(), for its messages
+};
+
+// Everything a run needs besides its rules and objects
+struct MesHandle {
+  MESSELECT def_or_undef;
+  MESLOGLEVEL logLevel;
+  int jobs;
+  int strtabAtEnd;
+  int dynamicSymbols; // rename .dynsym even when there is a .symtab
+  int io_buffered;    // read objects into memory instead of mapping them
+  int ioUring;        // read ahead through io_uring
+  int ioDepth;        // objects read ahead, -1 default
+  int commitAtomic;   // results renamed into place
+  int collectRenames;
+  char *cacheFile;    // manifest of processed objects
+  Cache cache;
+  uint64_t rulesKey;       // hash of the rules and options of the run
+  IoRing *readAhead;       // the run's read-ahead, NULL for none
+  Arena *scratchArenas;    // one per worker, see processObjectItem()
+  Arena *renameArenas;     // one per worker, hold the collected renames
+  CommitBatch commits;     // results waiting to be renamed into place
+  unsigned id;             // tells its results written aside apart
+  int stopping;            // the run's callback asked to stop
+  MesStats stats;          // of the last run
+  char *lastLog;           // the log of mes_process()'s object
+};
 
 // Combined 32/64-bit Elf Header Structure
 typedef struct {
@@ -55,8 +90,64 @@ typedef struct {
     unsigned char e_ident[EI_NIDENT];
   } ehdr;
   int elfclass;
+  int elfdata;
 } Elf_Ehdr;
 
+// A symbol of the object matched by a rule
+typedef struct {
+  long symidx;
+  int rule;
+  FLAGTYPE ft;
+  const char *name; // current name, in the input's .strtab
+} Match;
+
+// What the pass over an object's section header table found.  Indices
+// rather than pointers, since the table moves when the file grows.
+typedef struct {
+  size_t shnum;    // e_shnum, or sh_size of section 0 when that is 0
+  size_t shstrndx; // e_shstrndx, or sh_link of section 0 for SHN_XINDEX
+  size_t shndx;    // SHT_SYMTAB_SHNDX of the symbol table, 0 if none
+  unsigned long endOfSections; // end of the last section with file data
+} SectionTable;
+
+// Per-object state, so that several objects can be processed at once
+typedef struct {
+  MesHandle *h;
+  const RuleSet *rules;
+  char *objFileName;
+  char *outFileName; // NULL to modify objFileName in place
+  char *commitTarget; // commitAtomic: outFileName is renamed to this
+  int num;           // position of the object in the run
+  int outWritten;    // outFileName has been created by us
+  int member;        // an archive member: rules need not all match
+  int renamed;       // symbols renamed by the last processMapped()
+  int ioExtents;     // buffered: dirty ranges written back
+  int ioCalls;       // and the write calls that took
+  int cached;        // already processed with these rules
+  int stopped;       // left as it was, the run stopped before it was written
+  uint64_t bytesAdded; // new string table bytes
+  StrList renames;     // collectRenames: old name, new name, ...
+  Arena *renameArena;  // where 'renames' lives, NULL not to collect them
+  Arena *scratch;    // everything allocated for the object, reset after it
+  SectionTable sections;
+  FILE *out;    // this object's log
+  char *outbuf; // backing store of 'out'
+  size_t outlen;
+  int rc;
+  MESERROR err; // why rc is -1
+
+  Match *matches;
+  int matchCount;
+  int matchCap;
+
+  // Rename plan: symbol index, its new name and where that name lives
+  int planCount;
+  long *planSymIdx;
+  char **planNewName;
+  unsigned long *planStName;
+  char *planInPlace; // new name overwrites the old one in its own slot
+} ObjCtx;
+
 // Future function implementations:
 int readInElfHeader();
 int readInSymbolTable();
@@ -68,536 +159,1187 @@ int writeOutSymbolTable();
 int writeOutStringTable();
 int wrtieOutSectionHeaderTable();
 
-// Helper functions
-int runGetOpt(int argc, char **argv, int *objIndex, char **objList,
-              int *singleSymbolIndex, char **singleSymbolList,
-              int *keepNumSymbolIndex, char **keepNumSymbolList,
-              int *completeSymbolIndex, char **completeSymbolList,
-              char **singleStrPtr, char **keepNumStrPtr,
-              char **completeStrPtr) {
+int checkAndFindElfFile(ObjCtx *ctx, MappedFile *mf, Elf_Ehdr *ehdr) {
   if (debug_func)
-    printf("runGetOpt\n");
-  int c;
-  int digit_optind = 0;
-  while (1) {
-    int this_option_optind = optind ? optind : 1;
-    int option_index = 0;
-    static struct option long_options[] = {
-        {"object", required_argument, 0, 0},
-        {"singlesymbol", required_argument, 0, 1},
-        {"keepnumsymbol", required_argument, 0, 2},
-        {"singlestr", required_argument, 0, 3},
-        {"keepnumstr", required_argument, 0, 4},
-        {"completesymbol", required_argument, 0, 7},
-        {"completestr", required_argument, 0, 8},
-        {"only_def", no_argument, 0, 9},
-        {"only_undef", no_argument, 0, 10},
-        {"verbose", no_argument, 0, 'v'},
-        {0, 0, 0, 0}};
-
-    c = getopt_long(argc, argv, "o:s:k:c:v", long_options, &option_index);
-    if (c == -1)
-      break;
-
-    switch (c) {
-      printf("option %s", long_options[option_index].name);
-      if (optarg)
-        printf(" with arg %s", optarg);
-      printf("\n");
-
-    case 0: // object
-      objList[(*objIndex)++] = strdup(optarg);
-      break;
-    case 'o':
-      optind--;
-      do {
-        objList[(*objIndex)++] = strdup(argv[optind]);
-        optind++;
-      } while (optind < argc && *argv[optind] != '-');
-      break;
+    fprintf(ctx->out, "checkAndFindElfFile\n");
+  char *objFileName = mf->path;
 
-    case 1: // single symbol
-      singleSymbolList[(*singleSymbolIndex)++] = strdup(optarg);
-      break;
-    case 's':
-      optind--;
-      do {
-        singleSymbolList[(*singleSymbolIndex)++] = strdup(argv[optind]);
-        optind++;
-      } while (optind < argc && *argv[optind] != '-');
-      break;
-
-    case 2: // multiple symbol requiring numbering
-      if (objIndex == 0) {
-        printf("*** ***If need to assign numbering to symbol, list object "
-               "files first!\n");
-        perror("Syntax: ./replace-symbols-name -o <obj file> [obj files] "
-               "--keepnumsymbol=<symbol>");
-        exit(1);
-      }
-      keepNumSymbolList[(*keepNumSymbolIndex)++] = strdup(optarg);
-      break;
-    case 'k':
-      if (objIndex == 0) {
-        printf("*** ***If need to assign numbering to symbol, list object "
-               "files first!\n");
-        perror("Syntax: ./replace-symbols-name -o <obj file> [obj files] "
-               "--keepnumsymbol=<symbol>");
-        exit(1);
-      }
-      optind--;
-      do {
-        keepNumSymbolList[(*keepNumSymbolIndex)++] = strdup(argv[optind]);
-        optind++;
-      } while (optind < argc && *argv[optind] != '-');
-      break;
+  if (mf->size < EI_NIDENT) {
+    fprintf(ctx->out, "Not an ELF executable\n");
+    return -1;
+  }
+  memcpy(ehdr, mf->addr, EI_NIDENT);
 
-    case 7: // complete symbol replacement
-      completeSymbolList[(*completeSymbolIndex)++] = strdup(optarg);
-      break;
-    case 'c':
-      optind--;
-      do {
-        completeSymbolList[(*completeSymbolIndex)++] = strdup(argv[optind]);
-        optind++;
-      } while (optind < argc && *argv[optind] != '-');
-      break;
+  if (ehdr->ehdr.e_ident[EI_MAG0] != 0x7f ||
+      ehdr->ehdr.e_ident[EI_MAG1] != 'E' || // CHECK IF ELF
+      ehdr->ehdr.e_ident[EI_MAG2] != 'L' || ehdr->ehdr.e_ident[EI_MAG3] != 'F') {
+    fprintf(ctx->out, "Not an ELF executable\n");
+    return -1;
+  }
+  ehdr->elfclass = ehdr->ehdr.e_ident[EI_CLASS];
+  ehdr->elfdata = ehdr->ehdr.e_ident[EI_DATA];
+  if (ehdr->elfdata != ELFDATA2LSB && ehdr->elfdata != ELFDATA2MSB) {
+    fprintf(ctx->out, "Unknown ELF data encoding\n");
+    return -1;
+  }
+  // Now copy the rest of the header based on ELFCLASS32 or ELFCLASS64
+  size_t ehdr_size;
+  switch (ehdr->elfclass) {
+  case ELFCLASS32:
+    ehdr_size = sizeof(Elf32_Ehdr);
+    break;
+  case ELFCLASS64:
+    ehdr_size = sizeof(Elf64_Ehdr);
+    break;
+  default:
+    fprintf(ctx->out, "Unknown ELF Class\n");
+    return -1;
+  }
+  if (mf->size < ehdr_size) {
+    fprintf(ctx->out, "Truncated ELF header\n");
+    return -1;
+  }
+  memcpy(ehdr, mf->addr, ehdr_size);
+  // Note: the e_type has the same offset for 32 and 64 Elf Headers
+  uint16_t e_type = ehdr->ehdr.elf64_ehdr.e_type;
+  if ((ehdr->elfdata == ELFDATA2LSB) !=
+      (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+    e_type = __builtin_bswap16(e_type);
+  switch (e_type) {
+  case ET_EXEC:
+    if (ctx->h->logLevel >= MES_LOG_INFO)
+      fprintf(ctx->out, "WARNING: The ELf type is that of an executable. (%s)\n",
+              objFileName);
+    break;
+  case ET_REL:
+    if (ctx->h->logLevel >= MES_LOG_INFO)
+      fprintf(ctx->out, "SUCCESS: The ELF type is that of an relocatable. (%s)\n",
+              objFileName);
+    break;
+  case ET_DYN:
+    if (ctx->h->logLevel >= MES_LOG_INFO)
+      fprintf(ctx->out, "WARNING: The ELF type is that of a shared object. (%s)\n",
+              objFileName);
+    break;
+  default:
+    fprintf(ctx->out, "ERROR: The ELF type is that NOT of an EXEC, DYN nor REL. (%s)\n",
+           objFileName);
+    return -1;
+  }
+  return 0;
+}
 
-    case 3:
-      if (*singleStrPtr) {
-        free(*singleStrPtr);
-        printf("*** ***Only use the flag --singestr=<symbol> once.\n");
-        exit(1);
-      }
-      *singleStrPtr = strdup(optarg);
-      break;
-    case 4:
-      if (*keepNumStrPtr) {
-        free(*keepNumStrPtr);
-        printf("*** ***Only use the flag --keepnumstr=<symbol> once.\n");
-        exit(1);
-      }
-      *keepNumStrPtr = strdup(optarg);
-      break;
-    case 8:
-      if (*completeStrPtr) {
-        free(*completeStrPtr);
-        printf("*** ***Only use the flag --completestr=<symbol> once.\n");
-        exit(1);
-      }
-      *completeStrPtr = strdup(optarg);
-      break;
+// Whether the object itself gets modified: directly, or with
+// --commit=atomic by renaming a modified copy over it
+int modifiesInPlace(ObjCtx *ctx) {
+  return ctx->outFileName == NULL || ctx->commitTarget == ctx->objFileName;
+}
 
-    case 9:
-      if (def_or_undef == BOTH_DEF_AND_UNDEF) {
-        def_or_undef = ONLY_DEF;
-      } else {
-        printf("*** ***Only use flag --def or --undef once.\n");
-        exit(1);
-      }
-      break;
-    case 10:
-      if (def_or_undef == BOTH_DEF_AND_UNDEF) {
-        def_or_undef = ONLY_UNDEF;
-      } else {
-        printf("*** ***Only use flag --def or --undef once.\n");
-        exit(1);
-      }
-      break;
+// Where the result ends up
+char *resultPath(ObjCtx *ctx) {
+  if (ctx->commitTarget)
+    return ctx->commitTarget;
+  return ctx->outFileName ? ctx->outFileName : ctx->objFileName;
+}
 
-    case 'v':
-      if (verbose != 0) {
-        printf("*** ***Only use flag --verbose once.\n");
-        exit(1);
-      }
-      verbose = 1;
-      break;
+// The ring results are written back through, NULL for pwritev
+IoRing *writeRing(MesHandle *h) {
+  return ioring_backend(h->readAhead) == IORING_URING ? h->readAhead : NULL;
+}
 
-    case '?':
-      printf("\n*** invalid option given. (look above)\n\n");
-      return -1;
-      break;
+// Called before the object or its output is first written: once the run
+// is stopping, the object is left as it was.  Archive members are only
+// written as part of their archive.
+int stopBeforeWriting(ObjCtx *ctx) {
+  if (ctx->member || !__atomic_load_n(&ctx->h->stopping, __ATOMIC_ACQUIRE))
+    return 0;
+  ctx->stopped = 1;
+  return 1;
+}
 
-    default:
-      printf("?? getopt returned character code 0%o ??\n", c);
+int addMatch(ObjCtx *ctx, long symidx, int rule, const char *name) {
+  if (ctx->matchCount == ctx->matchCap) {
+    int cap = ctx->matchCap ? ctx->matchCap * 2 : 64;
+    Match *matches = arena_grow(ctx->scratch, ctx->matches,
+                                ctx->matchCap * sizeof(Match),
+                                cap * sizeof(Match));
+    if (matches == NULL)
       return -1;
-      break;
-    }
-  }
-
-  if (optind < argc) {
-    printf("non-option ARGV-elements: ");
-    while (optind < argc)
-      printf("%s ", argv[optind++]);
-    printf("\n");
+    ctx->matches = matches;
+    ctx->matchCap = cap;
   }
-
+  ctx->matches[ctx->matchCount].symidx = symidx;
+  ctx->matches[ctx->matchCount].rule = rule;
+  ctx->matches[ctx->matchCount].ft = ctx->rules->rules[rule].ft;
+  ctx->matches[ctx->matchCount].name = name;
+  ctx->matchCount++;
   return 0;
 }
 
-void printObjectFileNames(int count, char *list[]) {
-  if (debug_func)
-    printf("printObjectFileNames\n");
-  printf("The object files to modify are:\n");
-  for (int i = 0; i < count; ++i)
-    printf("(%d)\t%s\n", i, list[i]);
+int compareMatches(const void *a, const void *b) {
+  const Match *x = a, *y = b;
+  if (x->ft != y->ft)
+    return x->ft - y->ft;
+  if (x->rule != y->rule)
+    return x->rule - y->rule;
+  return (x->symidx > y->symidx) - (x->symidx < y->symidx);
 }
 
-void printSymbolsToChange(int count, char *list[], char *str, FLAGTYPE ft) {
+char *buildNewSymbolName(Arena *arena, const char *oldName, char *str,
+                         FLAGTYPE ft, int num) {
   if (debug_func)
-    printf("printSymbolsToChange\n");
+    printf("buildNewSymbolName\n");
+  char numbuf[16] = {0};
+  size_t size = strlen(oldName) + 1;
+  char *newString = NULL;
+
+  sprintf(numbuf, "%d", num + 1);
   switch (ft) {
   case SINGLESYM:
-    printf("\n%s", "Single Symbols ");
+    if (!str)
+      str = "__dmtcp_plt";
+    size += strlen(str);
     break;
   case KEEPNUMSYM:
-    printf("\n%s", "Keep number Symbols ");
+    if (!str)
+      str = "__dmtcp_";
+    size += strlen(str) + strlen(numbuf);
     break;
   case COMPLETESYM:
-    printf("\n%s", "Complete Symbols ");
+    if (!str) {
+      fprintf(stderr, "*** ***Complete symbols need --completestr=<symbol>.\n");
+      return NULL;
+    }
+    size = strlen(str) + 1;
     break;
-  default:
-    printf("*** ***Unknown flagtype in printSymbolsToChange function.");
-    exit(1);
   }
-  printf("%s\n", "planned on changing:");
+
+  newString = arena_calloc(arena, size, 1);
+  if (newString == NULL)
+    return NULL;
+  switch (ft) {
+  case SINGLESYM:
+    strcat(newString, oldName);
+    strcat(newString, str);
+    break;
+  case KEEPNUMSYM:
+    strcat(newString, oldName);
+    strcat(newString, str);
+    strcat(newString, numbuf);
+    break;
+  case COMPLETESYM:
+    strcat(newString, str);
+    break;
+  }
+  return newString;
+}
+
+// Turn the matched symbols into one list of (symbol, new name) pairs
+int planRenames(ObjCtx *ctx) {
+  if (debug_func)
+    printf("planRenames\n");
+  int count = ctx->matchCount;
+
+  ctx->planSymIdx = arena_alloc(ctx->scratch, count * sizeof(long));
+  ctx->planNewName = arena_calloc(ctx->scratch, count, sizeof(char *));
+  ctx->planStName = arena_alloc(ctx->scratch, count * sizeof(unsigned long));
+  ctx->planInPlace = arena_calloc(ctx->scratch, count, 1);
+  if (!ctx->planSymIdx || !ctx->planNewName || !ctx->planStName ||
+      !ctx->planInPlace)
+    return -1;
+
+  ctx->planCount = count;
   for (int i = 0; i < count; ++i) {
-    char buf[300] = {0};
-    strcat(buf, list[i]);
-    strcat(buf, " --> ");
-    switch (ft) {
-    case SINGLESYM:
-      strcat(buf, list[i]);
-      if (str) {
-        strcat(buf, str);
-      } else {
-        strcat(buf, "__dmtcp_plt");
-      }
-      break;
-    case KEEPNUMSYM:
-      strcat(buf, list[i]);
-      if (str) {
-        strcat(buf, str);
-        strcat(buf, "*");
-      } else {
-        strcat(buf, "__dmtcp_*");
-      }
-      break;
-    case COMPLETESYM:
-      strcat(buf, str);
-      break;
-    }
-    printf("(%d)\t%s\n", i, buf);
+    const Rule *rule = &ctx->rules->rules[ctx->matches[i].rule];
+    ctx->planSymIdx[i] = ctx->matches[i].symidx;
+    ctx->planNewName[i] = buildNewSymbolName(
+        ctx->scratch, ctx->matches[i].name, rule->str, rule->ft, ctx->num);
+    if (ctx->planNewName[i] == NULL)
+      return -1;
+    // Recorded now: renaming in place overwrites the old name
+    if (ctx->renameArena &&
+        (strlist_push(ctx->renameArena, &ctx->renames,
+                      ctx->matches[i].name) == -1 ||
+         strlist_push(ctx->renameArena, &ctx->renames,
+                      ctx->planNewName[i]) == -1))
+      return -1;
+  }
+  return 0;
+}
+
+int compareOffsets(const void *a, const void *b) {
+  unsigned long x = *(const unsigned long *)a;
+  unsigned long y = *(const unsigned long *)b;
+  return (x > y) - (x < y);
+}
+
+// Number of references in the sorted 'refs' that fall in [lo, hi]
+size_t countRefsInRange(unsigned long *refs, size_t nrefs, unsigned long lo,
+                        unsigned long hi) {
+  size_t a = 0, b = nrefs;
+  while (a < b) { // first ref >= lo
+    size_t mid = (a + b) / 2;
+    if (refs[mid] < lo)
+      a = mid + 1;
+    else
+      b = mid;
+  }
+  size_t first = a;
+  b = nrefs;
+  while (a < b) { // first ref > hi
+    size_t mid = (a + b) / 2;
+    if (refs[mid] <= hi)
+      a = mid + 1;
+    else
+      b = mid;
   }
+  return a - first;
 }
 
-int checkAndFindElfFile(char *objFileName, Elf_Ehdr *ehdr) {
+typedef struct {
+  unsigned long offset;
+  int planIdx;
+} PlanRef;
+
+int comparePlanRefs(const void *a, const void *b) {
+  const PlanRef *x = a, *y = b;
+  if (x->offset != y->offset)
+    return (x->offset > y->offset) - (x->offset < y->offset);
+  return x->planIdx - y->planIdx;
+}
+
+// A rename can overwrite the old string in place when the new name fits,
+// the old string starts right after a NUL (so it is not the tail of another
+// name), and nothing but the symbols being renamed to that same new name
+// points anywhere into it.  'refs' holds every string table reference in
+// the object, sorted; 'oldStName' the current st_name of each plan entry.
+// Returns the number of renames that will be done in place.
+int markInPlaceRenames(ObjCtx *ctx, const char *strtab_buf,
+                       unsigned long strtab_size, unsigned long *refs,
+                       size_t nrefs, unsigned long *oldStName) {
   if (debug_func)
-    printf("checkAndFindElfFile\n");
+    printf("markInPlaceRenames\n");
+  int inplace = 0;
+  PlanRef *byOffset =
+      arena_alloc(ctx->scratch, ctx->planCount * sizeof(PlanRef));
+  if (byOffset == NULL)
+    return -1;
+  for (int i = 0; i < ctx->planCount; ++i) {
+    byOffset[i].offset = oldStName[i];
+    byOffset[i].planIdx = i;
+  }
+  qsort(byOffset, ctx->planCount, sizeof(PlanRef), comparePlanRefs);
+
+  // Renames of the same old string are decided together
+  for (int g = 0, next; g < ctx->planCount; g = next) {
+    unsigned long o = byOffset[g].offset;
+    char *newName = ctx->planNewName[byOffset[g].planIdx];
+    int same = 1;
+    for (next = g + 1; next < ctx->planCount && byOffset[next].offset == o;
+         ++next)
+      same &= strcmp(newName, ctx->planNewName[byOffset[next].planIdx]) == 0;
+
+    if (!same || o == 0 || o >= strtab_size || strtab_buf[o - 1] != '\0')
+      continue;
+    size_t oldlen = strnlen(strtab_buf + o, strtab_size - o);
+    if (o + oldlen >= strtab_size || strlen(newName) > oldlen)
+      continue;
+    if (countRefsInRange(refs, nrefs, o, o + oldlen) != next - g)
+      continue;
+
+    for (int k = g; k < next; ++k) {
+      ctx->planInPlace[byOffset[k].planIdx] = 1;
+      ctx->planStName[byOffset[k].planIdx] = o;
+      inplace++;
+    }
+  }
+  return inplace;
+}
+
+// The ELF engine, instantiated below once per class and byte order
+typedef struct {
+  int (*processObject)(ObjCtx *ctx, MappedFile *mf);
+  int (*armapSymbols)(MappedFile *mf, Arena *arena, StrList *names);
+} ElfOps;
+
+#define ELF_N Elf64
+#define ELF_V Elf64LSB
+#define ELF_DATA ELFDATA2LSB
+#include "elfops.c"
+#define ELF_N Elf32
+#define ELF_V Elf32LSB
+#define ELF_DATA ELFDATA2LSB
+#include "elfops.c"
+#define ELF_N Elf64
+#define ELF_V Elf64MSB
+#define ELF_DATA ELFDATA2MSB
+#include "elfops.c"
+#define ELF_N Elf32
+#define ELF_V Elf32MSB
+#define ELF_DATA ELFDATA2MSB
+#include "elfops.c"
 
-  read_metadata(objFileName, (char *)ehdr, EI_NIDENT, 0);
+// The engine for an image of class 'elfclass' and byte order 'elfdata'
+static const ElfOps *findElfOps(int elfclass, int elfdata) {
+  int msb = elfdata == ELFDATA2MSB;
+  switch (elfclass) {
+  case ELFCLASS64:
+    return msb ? &elfOps_Elf64MSB : &elfOps_Elf64LSB;
+  case ELFCLASS32:
+    return msb ? &elfOps_Elf32MSB : &elfOps_Elf32LSB;
+  }
+  return NULL;
+}
 
-  if (ehdr->ehdr.e_ident[EI_MAG0] != 0x7f &&
-      ehdr->ehdr.e_ident[EI_MAG1] != 'E' && // CHECK IF ELF
-      ehdr->ehdr.e_ident[EI_MAG2] != 'L' && ehdr->ehdr.e_ident[EI_MAG3] != 'F') {
-    printf("Not an ELF executable\n");
+// Rename the symbols of the ELF image in 'mf'
+int processMapped(ObjCtx *ctx, MappedFile *mf) {
+  if (debug_func)
+    printf("processMapped\n");
+  Elf_Ehdr ehdr;
+  TraceSpan span;
+  int rc;
+
+  // Check if file is valid and read in the ELF header
+  trace_begin(&span, TRACE_CHECK_ELF);
+  rc = checkAndFindElfFile(ctx, mf, &ehdr);
+  trace_end(&span, ctx->num);
+  if (rc == -1) {
+    ctx->err = MES_ERR_FORMAT;
     return -1;
   }
-  ehdr->elfclass = ehdr->ehdr.e_ident[EI_CLASS];
-  if (ehdr->ehdr.e_ident[EI_DATA] != ELFDATA2LSB) {
-    printf("Not LSB Data\n");
+
+  const ElfOps *ops = findElfOps(ehdr.elfclass, ehdr.elfdata);
+  if (ops == NULL) {
+    fprintf(ctx->out, "ERROR: Unknown ELF Class");
+    ctx->err = MES_ERR_FORMAT;
+    rc = -1;
+  } else {
+    rc = ops->processObject(ctx, mf);
+  }
+
+  // The tables themselves go with the scratch arena
+  ctx->renamed = ctx->stopped ? 0 : ctx->planCount;
+  ctx->matches = NULL;
+  ctx->matchCount = ctx->matchCap = 0;
+  ctx->planCount = 0;
+  ctx->planSymIdx = NULL;
+  ctx->planNewName = NULL;
+  ctx->planStName = NULL;
+  ctx->planInPlace = NULL;
+  return rc;
+}
+
+// Write the archive: 'members' in their original order, ELF members that
+// were renamed taken from 'images', everything else cloned from 'ar', and
+// a rebuilt armap listing 'names' (symFirst[i] is the first name of
+// member i).  Goes through a temporary file renamed over the target.
+int writeArchive(ObjCtx *ctx, MappedFile *ar, ArMember *members, int count,
+                 MappedFile *images, int armap, StrList *names, int *symFirst) {
+  if (debug_func)
+    printf("writeArchive\n");
+  char *target = ctx->outFileName ? ctx->outFileName : ctx->objFileName;
+  uint64_t *outHdr = arena_alloc(ctx->scratch, count * sizeof(uint64_t));
+  uint64_t *symOffset =
+      arena_alloc(ctx->scratch, names->count * sizeof(uint64_t));
+  char *tmp = arena_alloc(ctx->scratch, strlen(target) + 8);
+  char *armapBuf = NULL;
+  size_t armapSize = 0;
+  int is64 = armap != -1 && members[armap].kind == AR_ARMAP64;
+  int fd = -1;
+  int created = 0;
+  int rc = -1;
+
+  if (outHdr == NULL || symOffset == NULL || tmp == NULL)
+    goto out;
+
+  // Lay the members out behind the new armap
+  size_t namesLen = 0;
+  for (int s = 0; s < names->count; ++s)
+    namesLen += strlen(names->items[s]) + 1;
+  for (;;) {
+    uint64_t pos = AR_MAGIC_SIZE;
+    if (armap != -1) {
+      armapSize = ar_armap_size(names->count, namesLen, is64);
+      pos += AR_HDR_SIZE + armapSize;
+    }
+    for (int i = 0; i < count; ++i) {
+      if (i == armap)
+        continue;
+      size_t size = images[i].addr ? images[i].size : members[i].size;
+      outHdr[i] = pos;
+      pos += AR_HDR_SIZE + size + (size & 1);
+    }
+    if (is64 || pos <= UINT32_MAX)
+      break;
+    is64 = 1; // offsets no longer fit the 32 bit armap
+  }
+
+  sprintf(tmp, "%s.XXXXXX", target);
+  fd = mkstemp(tmp);
+  if (fd == -1) {
+    perror(tmp);
+    goto out;
+  }
+  created = 1;
+  if (fchmod(fd, ar->mode & 0777) == -1)
+    perror("fchmod");
+  if (pwriteall(fd, AR_MAGIC, AR_MAGIC_SIZE, 0) == -1)
+    goto write_error;
+
+  if (armap != -1) {
+    char hdr[AR_HDR_SIZE];
+    int m = 0;
+    for (int s = 0; s < names->count; ++s) {
+      while (symFirst[m + 1] <= s)
+        ++m;
+      symOffset[s] = outHdr[m];
+    }
+    armapBuf = arena_alloc(ctx->scratch, armapSize);
+    if (armapBuf == NULL)
+      goto out;
+    ar_write_armap(armapBuf, armapSize, names->count, symOffset, names->items,
+                   is64);
+    memcpy(hdr, ar->addr + members[armap].hdr, AR_HDR_SIZE);
+    memcpy(hdr, is64 ? "/SYM64/         " : "/               ", 16);
+    ar_patch_header(hdr, armapSize);
+    if (pwriteall(fd, hdr, AR_HDR_SIZE, AR_MAGIC_SIZE) == -1 ||
+        pwriteall(fd, armapBuf, armapSize, AR_MAGIC_SIZE + AR_HDR_SIZE) == -1)
+      goto write_error;
+  }
+
+  uint64_t end = AR_MAGIC_SIZE;
+  for (int i = 0; i < count; ++i) {
+    if (i == armap)
+      continue;
+    if (images[i].addr) {
+      char hdr[AR_HDR_SIZE];
+      memcpy(hdr, ar->addr + members[i].hdr, AR_HDR_SIZE);
+      ar_patch_header(hdr, images[i].size);
+      if (pwriteall(fd, hdr, AR_HDR_SIZE, outHdr[i]) == -1 ||
+          pwriteall(fd, images[i].addr, images[i].size,
+                      outHdr[i] + AR_HDR_SIZE) == -1)
+        goto write_error;
+      end = outHdr[i] + AR_HDR_SIZE + images[i].size;
+    } else {
+      if (clone_range(ar->fd, members[i].hdr, fd, outHdr[i],
+                      AR_HDR_SIZE + members[i].size) == -1)
+        goto out;
+      end = outHdr[i] + AR_HDR_SIZE + members[i].size;
+    }
+    if (end & 1) {
+      if (pwriteall(fd, "\n", 1, end) == -1)
+        goto write_error;
+      end++;
+    }
+  }
+  if (ftruncate(fd, end) == -1)
+    goto write_error;
+  if (close(fd) == -1)
+    goto write_error;
+  fd = -1;
+  // A result written aside never replaces a file that is already there
+  if (renameat2(AT_FDCWD, tmp, AT_FDCWD, target,
+                ctx->commitTarget ? RENAME_NOREPLACE : 0) == -1) {
+    perror(target);
+    goto out;
+  }
+  created = 0;
+  rc = 0;
+  goto out;
+
+write_error:
+  perror(tmp);
+out:
+  if (fd != -1)
+    close(fd);
+  if (created)
+    unlink(tmp);
+  return rc;
+}
+// A static library: rename inside every ELF member, then write the archive
+// back with the members that changed and a rebuilt armap.  The archive is
+// mapped privately, members are edited where they lie and only get a copy
+// of their own when they have to grow.
+int processArchive(ObjCtx *ctx, MappedFile *ar) {
+  if (debug_func)
+    printf("processArchive\n");
+  ArMember *members = NULL;
+  MappedFile *images = NULL;
+  int *symFirst = NULL;
+  StrList names = {0};
+  int count = 0, armap = -1, renamed = 0;
+  int rc = -1;
+
+  if (memcmp(ar->addr, AR_THIN_MAGIC, AR_MAGIC_SIZE) == 0) {
+    fprintf(ctx->out, "ERROR: Thin archives are not supported. (%s)\n",
+            ctx->objFileName);
+    ctx->err = MES_ERR_FORMAT;
     return -1;
   }
-  // Now read the rest of the header based on ELFCLASS32 or ELFCLASS64
-  switch (ehdr->elfclass) {
-  case ELFCLASS32:
-    read_metadata(objFileName, (char *)ehdr, sizeof(Elf32_Ehdr), 0);
-    break;
-  case ELFCLASS64:
-    read_metadata(objFileName, (char *)ehdr, sizeof(Elf64_Ehdr), 0);
-    break;
-  default:
-    printf("Unknown ELF Class\n");
+  if (ar->writable) {
+    unmap_file(ar);
+    if (map_file(ctx->objFileName, ar, 0, ctx->h->io_buffered) == -1) {
+      ctx->err = MES_ERR_IO;
+      return -1;
+    }
+  }
+  if (mprotect(ar->addr, ar->size, PROT_READ | PROT_WRITE) == -1) {
+    perror("mprotect");
     return -1;
   }
-  // Note: the e_type has the same offset for 32 and 64 Elf Headers
-  switch (ehdr->ehdr.elf64_ehdr.e_type) {
-  case ET_EXEC:
-    printf("WARNING: The ELf type is that of an executable. (%s)\n",
-           objFileName);
-    break;
-  case ET_REL:
-    printf("SUCCESS: The ELF type is that of an relocatable. (%s)\n",
-           objFileName);
-    break;
-  default:
-    printf("ERROR: The ELF type is that NOT of an EXEC nor REL. (%s)\n",
-           objFileName);
+  if (ar_parse(ar->addr, ar->size, &members, &count) == -1) {
+    fprintf(ctx->out, "ERROR: Malformed archive. (%s)\n", ctx->objFileName);
+    ctx->err = MES_ERR_FORMAT;
     return -1;
   }
+  images = arena_calloc(ctx->scratch, count, sizeof(MappedFile));
+  symFirst = arena_calloc(ctx->scratch, count + 1, sizeof(int));
+  if (images == NULL || symFirst == NULL)
+    goto out;
+
+  if (ctx->h->logLevel >= MES_LOG_INFO)
+    fprintf(ctx->out, "Archive %s: %d member(s)\n", ctx->objFileName, count);
+  for (int i = 0; i < count; ++i) {
+    ArMember *m = &members[i];
+    char *data = ar->addr + m->data;
+    symFirst[i] = names.count;
+    if (m->kind == AR_ARMAP || m->kind == AR_ARMAP64) {
+      armap = i;
+      continue;
+    }
+    if (m->kind != AR_MEMBER || m->size < SELFMAG ||
+        memcmp(data, ELFMAG, SELFMAG) != 0)
+      continue;
+
+    char *label = arena_alloc(ctx->scratch, strlen(ctx->objFileName) +
+                                                m->namelen + 3);
+    if (label == NULL)
+      goto out;
+    sprintf(label, "%s(%.*s)", ctx->objFileName, (int)m->namelen, m->name);
+
+    // The ELF code wants its headers aligned; members are only 2 aligned
+    MappedFile mf;
+    if (map_memory(label, data, m->size, &mf, m->data % 8 == 0) == -1)
+      goto out;
+    ObjCtx member = *ctx;
+    member.objFileName = label;
+    member.outFileName = NULL;
+    member.member = 1;
+    int failed = processMapped(&member, &mf) == -1;
+    // What was done to the member counts for the archive
+    ctx->bytesAdded = member.bytesAdded;
+    ctx->renames = member.renames;
+    ctx->err = member.err;
+    if (failed) {
+      unmap_file(&mf);
+      goto out;
+    }
+
+    // processMapped() accepted it, so there is an engine for it
+    const ElfOps *ops = findElfOps(mf.addr[EI_CLASS], mf.addr[EI_DATA]);
+    if (ops->armapSymbols(&mf, ctx->scratch, &names) == -1) {
+      unmap_file(&mf);
+      goto out;
+    }
+    if (member.renamed) {
+      images[i] = mf; // written out below
+      renamed += member.renamed;
+    } else {
+      unmap_file(&mf);
+    }
+  }
+  symFirst[count] = names.count;
+
+  if ((renamed == 0 && modifiesInPlace(ctx)) || stopBeforeWriting(ctx)) {
+    ctx->renamed = 0;
+    rc = 0; // nothing changed
+    goto out;
+  }
+  ctx->renamed = renamed;
+  TraceSpan span;
+  trace_begin(&span, TRACE_WRITE_ARCHIVE);
+  rc = writeArchive(ctx, ar, members, count, images, armap, &names, symFirst);
+  trace_end(&span, ctx->num);
+  if (rc == 0 && ctx->outFileName)
+    ctx->outWritten = 1;
+  if (rc == 0 && ctx->h->logLevel >= MES_LOG_INFO)
+    fprintf(ctx->out, "Archive %s: %d symbol(s) renamed, %d in index\n",
+            resultPath(ctx), renamed,
+            armap != -1 ? names.count : 0);
+
+out:
+  for (int i = 0; images && i < count; ++i)
+    unmap_file(&images[i]);
+  free(members);
+  return rc;
+}
+
+// The key the rules are cached under for this object: with numbering the
+// result also depends on the object's position
+uint64_t objectRulesKey(ObjCtx *ctx) {
+  if (ctx->rules->countByFt[KEEPNUMSYM] == 0)
+    return ctx->h->rulesKey;
+  return hash64(&ctx->num, sizeof(ctx->num), ctx->h->rulesKey);
+}
+
+// Hash of the contents of 'path'; -1 if it cannot be read
+int hashFile(ObjCtx *ctx, char *path, uint64_t *hash) {
+  MappedFile mf;
+  if (access(path, F_OK) == -1 ||
+      map_file(path, &mf, 0, ctx->h->io_buffered) == -1)
+    return -1;
+  *hash = hash64(mf.addr, mf.size, 0);
+  unmap_file(&mf);
   return 0;
 }
 
-int calculateBytesNeeded(int index, char **list, char *str, FLAGTYPE ft) {
+// Whether an object whose contents hash to 'in' needs no work: modified
+// in place it is already the result of these rules, written elsewhere the
+// output is what these rules made of it
+int alreadyProcessed(ObjCtx *ctx, uint64_t key, uint64_t in) {
   if (debug_func)
-    printf("calculateBytesNeeded\n");
-  int result = 0;
-
-  for (int i = 0; i < index; ++i) {
-    char strNum[300] = {0};
-    sprintf(strNum, "%d", i + 1);
-
-    switch (ft) {
-    case SINGLESYM:
-      result += strlen(list[i]);
-      if (str)
-        result += strlen(str) + 1;
-      else
-        result += strlen("__dmtcp_plt") + 1;
-      break;
-    case KEEPNUMSYM:
-      result += strlen(list[i]);
-      if (str)
-        result += strlen(strNum) + 1;
-      else
-        result += strlen("__dmtcp_") + strlen(strNum) + 1;
-      break;
-    case COMPLETESYM:
-      if (str)
-        result += strlen(str) + 1;
-      break;
+    printf("alreadyProcessed\n");
+  uint64_t out;
+  if (modifiesInPlace(ctx)) {
+    if (cache_find_out(&ctx->h->cache, in, key) == NULL)
+      return 0;
+    cache_mark(ctx->objFileName, key, in);
+    return 1;
+  }
+  const CacheEntry *e = cache_find_in(&ctx->h->cache, in, key);
+  if (e == NULL)
+    return 0;
+  if (cache_marked(resultPath(ctx), key, &out))
+    return out == e->out;
+  if (hashFile(ctx, resultPath(ctx), &out) == -1 || out != e->out)
+    return 0;
+  cache_mark(resultPath(ctx), key, out);
+  return 1;
+}
+
+int processObject(ObjCtx *ctx) {
+  if (debug_func)
+    printf("processObject\n");
+  MesHandle *h = ctx->h;
+  MappedFile mf;
+  TraceSpan span, sync;
+  uint64_t key = 0, in = 0, out = 0;
+  mode_t mode;
+  int archive, rc;
+
+  // Objects modified in place carry a mark; one that has not changed since
+  // needs neither reading nor hashing
+  trace_begin(&span, TRACE_OBJECT);
+  if (h->cacheFile) {
+    key = objectRulesKey(ctx);
+    if (modifiesInPlace(ctx) && cache_marked(ctx->objFileName, key, &out) &&
+        cache_find_out(&h->cache, out, key) != NULL)
+      ctx->cached = 1;
+  }
+  if (ctx->cached)
+    ioring_skip(h->readAhead, ctx->num);
+
+  // Map the object once; every phase below works on the mapping.  When
+  // writing elsewhere the input is never modified, so map it read-only.
+  // An object read ahead is handed over already in memory.
+  if (!ctx->cached && ioring_take(h->readAhead, ctx->num, &mf) != 0) {
+    if (map_file(ctx->objFileName, &mf, ctx->outFileName == NULL,
+                 h->io_buffered) == -1) {
+      ctx->err = MES_ERR_IO;
+      return -1;
+    }
+    // Everything of a run reading through io_uring is written through it
+    mf.ring = writeRing(h);
+  }
+  if (h->cacheFile && !ctx->cached) {
+    in = hash64(mf.addr, mf.size, 0);
+    if (alreadyProcessed(ctx, key, in)) {
+      unmap_file(&mf);
+      ctx->cached = 1;
     }
   }
+  if (ctx->cached) {
+    if (h->logLevel >= MES_LOG_INFO)
+      fprintf(ctx->out, "%s: already processed with these rules, skipped\n",
+              ctx->objFileName);
+    trace_end(&span, ctx->num);
+    return 0;
+  }
+
+  mode = mf.mode;
+  archive = mf.size >= AR_MAGIC_SIZE &&
+            (memcmp(mf.addr, AR_MAGIC, AR_MAGIC_SIZE) == 0 ||
+             memcmp(mf.addr, AR_THIN_MAGIC, AR_MAGIC_SIZE) == 0);
+  if (archive)
+    rc = processArchive(ctx, &mf);
+  else
+    rc = processMapped(ctx, &mf);
+
+  trace_begin(&sync, TRACE_SYNC);
+  if (rc != -1 && flush_mapped_file(&mf) == -1) {
+    ctx->err = MES_ERR_IO;
+    rc = -1;
+  }
+  // The mapping holds the result now, except for archives, which are
+  // written through a file of their own
+  if (h->cacheFile && rc != -1 && !archive && !ctx->stopped)
+    out = hash64(mf.addr, mf.size, 0);
+  unmap_file(&mf);
+  trace_end(&sync, ctx->num);
+  if (mf.flushedExtents) {
+    // Writing each range on its own would have taken one call per range
+    if (h->logLevel >= MES_LOG_INFO)
+      fprintf(ctx->out,
+              "\t\twriteback: %d dirty range(s) in %d %s call(s), %d "
+              "syscall(s) saved\n",
+              mf.flushedExtents, mf.flushCalls,
+              mf.ring ? "io_uring_enter" : "pwritev",
+              mf.flushedExtents - mf.flushCalls);
+    ctx->ioExtents += mf.flushedExtents;
+    ctx->ioCalls += mf.flushCalls;
+  }
+  // A copy renamed over the object keeps the object's permissions
+  if (rc != -1 && ctx->outWritten && ctx->commitTarget == ctx->objFileName &&
+      chmod(ctx->outFileName, mode & 07777) == -1) {
+    perror(ctx->outFileName);
+    rc = -1;
+  }
+  if (rc == -1 && ctx->outWritten)
+    unlink(ctx->outFileName);
+
+  if (h->cacheFile && rc != -1 && !ctx->stopped) {
+    char *target = ctx->outWritten ? ctx->outFileName : ctx->objFileName;
+    if (archive && hashFile(ctx, target, &out) == -1)
+      rc = -1;
+    else if (cache_add(&h->cache, in, key, out) == -1)
+      rc = -1;
+    else
+      cache_mark(target, key, out);
+  }
+  trace_end(&span, ctx->num);
+  return rc;
+}
 
-  // align on 64 bytes..
-  result = (result + 63) & -64;
 
-  return result;
+// What ioring reads ahead: the objects in the order given
+char *readAheadFile(int item, void *arg, int *writable) {
+  ObjCtx *ctx = (ObjCtx *)arg + item;
+  *writable = ctx->outFileName == NULL;
+  return ctx->objFileName;
 }
 
-#define ELF_N Elf64
-#include "elfops.c"
-#define ELF_N Elf32
-#include "elfops.c"
+// io_uring read-ahead, or with an io depth posix_fadvise: read the next
+// objects while the workers are busy with the current ones
+IoRing *startReadAhead(MesHandle *h, ObjCtx *ctxs, int count) {
+  int depth = h->ioDepth != -1 ? h->ioDepth
+              : h->ioUring    ? IORING_DEFAULT_DEPTH
+                              : 0;
+  h->stats.ioDepth = depth;
+  return ioring_start(h->ioUring ? IORING_URING : IORING_FADVISE, count,
+                      depth, readAheadFile, ctxs);
+}
+
+// A run in progress
+typedef struct {
+  MesHandle *h;
+  ObjCtx *ctxs;
+  mes_result_fn done;
+  void *arg;
+  MESERROR err; // of the first object that failed
+  int emitted;  // objects handed to 'done'
+} MesRun;
+
+// Worker pool callbacks
+void processObjectItem(int item, void *arg) {
+  MesRun *run = arg;
+  ObjCtx *ctx = run->ctxs + item;
+  // The log is buffered so objects finishing out of order don't
+  // interleave; it goes to the caller with the result
+  ctx->out = open_memstream(&ctx->outbuf, &ctx->outlen);
+  if (ctx->out == NULL) {
+    ctx->rc = -1;
+    ctx->err = MES_ERR_NOMEM;
+    return;
+  }
+  // Whatever the object needs comes from the worker's scratch arena, which
+  // keeps its memory for the next object
+  ctx->scratch = &run->h->scratchArenas[workpool_worker()];
+  if (run->h->collectRenames)
+    ctx->renameArena = &run->h->renameArenas[workpool_worker()];
+  ctx->rc = processObject(ctx);
+  if (ctx->rc == -1 && ctx->err == MES_OK)
+    ctx->err = MES_ERR_OBJECT;
+  arena_reset(ctx->scratch);
+  ctx->scratch = NULL;
+}
+
+// commitAtomic: queue the finished result of 'ctx' to be renamed over its
+// target; results are committed in groups
+int queueCommit(ObjCtx *ctx) {
+  CommitBatch *commits = &ctx->h->commits;
+  if (ctx->commitTarget == NULL || !ctx->outWritten)
+    return 0;
+  if (commit_add(commits, ctx->outFileName, ctx->commitTarget) == -1)
+    return -1;
+  if (commits->count < COMMIT_GROUP)
+    return 0;
+  return commit_flush(commits);
+}
+
+int emitObjectItem(int item, void *arg) {
+  MesRun *run = arg;
+  MesHandle *h = run->h;
+  ObjCtx *ctx = run->ctxs + item;
+  if (ctx->out)
+    fclose(ctx->out);
+  if (ctx->rc != -1 && queueCommit(ctx) == -1) {
+    unlink(ctx->outFileName);
+    ctx->rc = -1;
+    ctx->err = MES_ERR_COMMIT;
+  }
+  if (ctx->rc == -1) {
+    // The objects before it are done, commit them before telling
+    commit_flush(&h->commits);
+    h->stats.failed++;
+    if (run->err == MES_OK)
+      run->err = ctx->err;
+  }
+  h->stats.renamed += ctx->renamed;
+  h->stats.cached += ctx->cached;
+  h->stats.ioExtents += ctx->ioExtents;
+  h->stats.ioCalls += ctx->ioCalls;
+
+  MesResult result = {
+      .path = ctx->objFileName,
+      .output = modifiesInPlace(ctx) ? NULL : resultPath(ctx),
+      .status = ctx->rc == -1 ? ctx->err : MES_OK,
+      .cached = ctx->cached,
+      .renamed = ctx->renamed,
+      .bytesAdded = ctx->bytesAdded,
+      .log = ctx->outbuf ? ctx->outbuf : "",
+      .logLen = ctx->outlen,
+      .renames = (const char *const *)ctx->renames.items,
+      .renameCount = ctx->renames.count / 2,
+  };
+  int stop = run->done ? run->done(&result, item, run->arg) : 0;
+  free(ctx->outbuf);
+  ctx->outbuf = NULL;
+  run->emitted++;
+  // Objects in progress see this before they write anything
+  if (stop)
+    __atomic_store_n(&h->stopping, 1, __ATOMIC_RELEASE);
+  return stop;
+}
+
+// The run was stopped at object 'from' - 1.  The objects after it that
+// had changed their target before the stop are reported all the same;
+// those left alone are dropped, and results written aside are removed.
+void dropObjectItems(MesRun *run, int from, int count) {
+  for (int i = from; i < count; ++i) {
+    ObjCtx *ctx = run->ctxs + i;
+    if (ctx->out == NULL)
+      continue; // never started
+    if (!ctx->stopped && ctx->commitTarget == NULL) {
+      emitObjectItem(i, run);
+      continue;
+    }
+    fclose(ctx->out);
+    free(ctx->outbuf);
+    ctx->outbuf = NULL;
+    if (ctx->rc != -1 && ctx->commitTarget && ctx->outWritten)
+      unlink(ctx->outFileName);
+  }
+}
 
-// Main
-int main(int argc, char **argv) {
+// Set up one context per object; temporary paths are allocated in 'arena'
+int initObjCtxs(MesHandle *h, ObjCtx *ctxs, int count,
+                const char *const *objs, const char *const *outs,
+                const RuleSet *rules, Arena *arena) {
+  for (int i = 0; i < count; ++i) {
+    ctxs[i].h = h;
+    ctxs[i].rules = rules;
+    ctxs[i].objFileName = (char *)objs[i];
+    ctxs[i].outFileName = outs ? (char *)outs[i] : NULL;
+    ctxs[i].num = i;
+    if (h->commitAtomic) {
+      // The result is written next to its target and renamed over it
+      char *target = ctxs[i].outFileName ? ctxs[i].outFileName
+                                         : ctxs[i].objFileName;
+      ctxs[i].commitTarget = target;
+      // next to its target, under a name no other run or handle uses
+      ctxs[i].outFileName = arena_alloc(arena, strlen(target) + 48);
+      if (ctxs[i].outFileName == NULL)
+        return -1;
+      sprintf(ctxs[i].outFileName, "%s.mes-%d-%u-%d.tmp", target,
+              (int)getpid(), h->id, i);
+    }
+  }
+  return 0;
+}
+
+// The library interface, see modelfsymbol.h
+
+void mes_options_init(MesOptions *opts) {
+  memset(opts, 0, sizeof(*opts));
+  opts->jobs = 1;
+  opts->ioDepth = -1;
+}
+
+const char *mes_strerror(MESERROR err) {
+  static const char *messages[] = {
+      "Success",
+      "Invalid argument",
+      "Out of memory",
+      "The rules could not be read",
+      "The object could not be read or written",
+      "Not an ELF object or archive that can be handled",
+      "The symbols of the object could not be renamed",
+      "The cache manifest could not be read or written",
+      "The result could not be renamed into place",
+  };
+  if ((unsigned)err >= sizeof(messages) / sizeof(messages[0]))
+    return "Unknown error";
+  return messages[err];
+}
+
+MesRules *mes_rules_new(void) {
+  return calloc(1, sizeof(MesRules));
+}
+
+MESERROR mes_rules_add(MesRules *rules, MESRULE kind, const char *symbol,
+                       const char *str) {
+  if (rules == NULL || symbol == NULL || rules->finished ||
+      (unsigned)kind > MES_RENAME || (kind == MES_RENAME && str == NULL))
+    return MES_ERR_ARGS;
+  if (ruleset_add(&rules->rs, symbol, str, (FLAGTYPE)kind) == -1)
+    return MES_ERR_NOMEM;
+  return MES_OK;
+}
+
+MESERROR mes_rules_add_pattern(MesRules *rules, MESMATCH match,
+                               const char *pattern, const char *str) {
+  if (rules == NULL || pattern == NULL || rules->finished ||
+      match < MES_MATCH_PREFIX || match > MES_MATCH_GLOB)
+    return MES_ERR_ARGS;
+  if (ruleset_add_pattern(&rules->rs, (MATCHTYPE)match, pattern, str) == -1)
+    return MES_ERR_NOMEM;
+  return MES_OK;
+}
+
+// One line in rules file syntax
+MESERROR mes_rules_add_line(MesRules *rules, const char *line) {
+  if (rules == NULL || line == NULL || rules->finished)
+    return MES_ERR_ARGS;
+  char *copy = strdup(line);
+  if (copy == NULL)
+    return MES_ERR_NOMEM;
+  int rc = ruleset_add_line(&rules->rs, copy, "rule", ++rules->lines);
+  free(copy);
+  return rc == -1 ? MES_ERR_RULES : MES_OK;
+}
+
+MESERROR mes_rules_load(MesRules *rules, const char *path) {
+  if (rules == NULL || path == NULL || rules->finished)
+    return MES_ERR_ARGS;
+  if (ruleset_load_file(&rules->rs, path) == -1)
+    return MES_ERR_RULES;
+  return MES_OK;
+}
+
+int mes_rules_count(const MesRules *rules) {
+  return rules ? rules->rs.count : 0;
+}
+
+void mes_rules_free(MesRules *rules) {
+  if (rules == NULL)
+    return;
+  ruleset_free(&rules->rs);
+  free(rules);
+}
+
+MESERROR mes_open(const MesOptions *opts, MesHandle **handle) {
   if (debug_func)
-    printf("main\n");
-  int objIndex = 0;
-  char **objList = malloc(300 * sizeof(char *));
-
-  int singleSymbolIndex = 0;
-  char **singleSymbolList =
-      malloc(300 * sizeof(char *)); // Symbols to add "__dmtcp_plt" to
-  char *singleStr = NULL;
-
-  int keepNumSymbolIndex = 0;
-  char **keepNumSymbolList = malloc(
-      300 * sizeof(char *)); // Symbols to add "__dmtcp_*" to, where * is 0 to n
-  char *keepNumStr = NULL;
-
-  int completeSymbolIndex = 0;
-  char **completeSymbolList = malloc(
-      300 * sizeof(char *)); // Symbols to compeltely replace with completeStr
-  char *completeStr = NULL;
-
-  // KJ Elf64_Shdr * shdr = NULL;
-  // KJ Elf64_Shdr * symtab = NULL;
-  // KJ Elf64_Shdr * strtab = NULL;
-  // KJ unsigned long prev_strtab_size = 0;
-
-  printf(
-      "\n\n%s\n\n",
-      "+++++++++++++++++++++++++++++++++ Started replace-symbols-name Program");
-
-  if (argc < 4) {
-    // perror("Syntax: ./change-symbol-names <obj file> symbol [othersymbols]");
-    perror("Syntax: ./replace-symbols-name [-o | -s | --singlesymbol | "
-           "--keepnumsymbol]");
-    exit(1);
-  }
-
-  // Parse the arguments!
-  assert(runGetOpt(argc, argv, &objIndex, objList, &singleSymbolIndex,
-                   singleSymbolList, &keepNumSymbolIndex, keepNumSymbolList,
-                   &completeSymbolIndex, completeSymbolList, &singleStr,
-                   &keepNumStr, &completeStr) != -1);
-
-  // Let user know which object files are going to change
-  printObjectFileNames(objIndex, objList);
-
-  // Let user know which symbols are going to change
-  // assert(singleSymbolIndex + keepNumSymbolIndex > 0);
-  if (singleSymbolIndex)
-    printSymbolsToChange(singleSymbolIndex, singleSymbolList, singleStr,
-                         SINGLESYM);
-  if (keepNumSymbolIndex)
-    printSymbolsToChange(keepNumSymbolIndex, keepNumSymbolList, keepNumStr,
-                         KEEPNUMSYM);
-  if (completeSymbolIndex)
-    printSymbolsToChange(completeSymbolIndex, completeSymbolList, completeStr,
-                         COMPLETESYM);
-  printf("\n\n");
-
-  for (int i = 0; i < objIndex; ++i) {
-    unsigned long prev_strtab_size = 0;
-    Elf_Ehdr ehdr;
-
-    memset(actualSingleSymbolsToReplace, 0,
-           sizeof(actualSingleSymbolsToReplace));
-    memset(actualKeepNumSymbolsToReplace, 0,
-           sizeof(actualKeepNumSymbolsToReplace));
-    memset(actualCompleteSymbolsToReplace, 0,
-           sizeof(actualCompleteSymbolsToReplace));
-    actualSingleSymbolsIndex = 0;
-    actualKeepNumSymbolsIndex = 0;
-    actualCompleteSymbolsIndex = 0;
-
-    // Check if file is valid and read in the ELF header
-    assert(checkAndFindElfFile(objList[i], &ehdr) != -1);
-
-    /************************************************************/
-    if (ehdr.elfclass == ELFCLASS64) {
-      // Find symbol table and string table
-      //   - shdr = malloc(); <-- on heap
-      Elf64_Shdr *shdr = NULL;
-      Elf64_Shdr *symtab = NULL;
-      Elf64_Shdr *strtab = NULL;
-      assert(findSymtabAndStrtabAndShdr_Elf64(objList[i], ehdr.ehdr.elf64_ehdr,
-					      &shdr, &symtab, &strtab) != -1);
-      prev_strtab_size = strtab->sh_size;
-
-      // Check if the symbols exist first..
-      int symcount = 0;
-      assert(checkIfSymbolsExist_Elf64(objList[i], singleSymbolIndex,
-				       singleSymbolList,
-				       keepNumSymbolIndex, keepNumSymbolList,
-				       completeSymbolIndex, completeSymbolList,
-				       symtab, strtab, &symcount) != -1);
-      if (!symcount) {
-	printf("        ^ ^ ^ continue\n\n");
-	free(shdr);
-	continue;
-      }
-
-      // Extend the string table and whatever follows after..
-      // Fix Elf header and Section header Table
-      int add_space = calculateBytesNeeded(actualSingleSymbolsIndex,
-					   actualSingleSymbolsToReplace,
-					   singleStr, SINGLESYM) +
-                      calculateBytesNeeded(actualKeepNumSymbolsIndex,
-					   actualKeepNumSymbolsToReplace,
-					   keepNumStr, KEEPNUMSYM) +
-                      calculateBytesNeeded(actualCompleteSymbolsIndex,
-					   actualCompleteSymbolsToReplace,
-					   completeStr, COMPLETESYM);
-      if (debug)
-	printf("ADD_SPACE is: %x\n", add_space);
-      assert(extendAndFixAfterStrtab_Elf64(objList[i], &(ehdr.ehdr.elf64_ehdr),
-					   &shdr, &symtab, &strtab,
-					   add_space) != -1);
-
-      // Add dmtcp symbol name(s) and update symtab
-      assert(addSymbolsAndUpdateSymtab_Elf64(objList[i], i,
-				     actualSingleSymbolsIndex,
-				     actualSingleSymbolsToReplace, symtab,
-                                     strtab, &prev_strtab_size, singleStr,
-                                     SINGLESYM) != -1);
-      assert(addSymbolsAndUpdateSymtab_Elf64(objList[i], i,
-				     actualKeepNumSymbolsIndex,
-                                     actualKeepNumSymbolsToReplace, symtab,
-                                     strtab, &prev_strtab_size, keepNumStr,
-                                     KEEPNUMSYM) != -1);
-      assert(addSymbolsAndUpdateSymtab_Elf64(objList[i], i,
-				     actualCompleteSymbolsIndex,
-                                     actualCompleteSymbolsToReplace, symtab,
-                                     strtab, &prev_strtab_size, completeStr,
-                                     COMPLETESYM) != -1);
-
-      for (int tmp_i = 0; tmp_i < actualSingleSymbolsIndex; ++tmp_i)
-	free(actualSingleSymbolsToReplace[tmp_i]);
-      for (int tmp_i = 0; tmp_i < actualKeepNumSymbolsIndex; ++tmp_i)
-	free(actualKeepNumSymbolsToReplace[tmp_i]);
-      for (int tmp_i = 0; tmp_i < actualCompleteSymbolsIndex; ++tmp_i)
-	free(actualCompleteSymbolsToReplace[tmp_i]);
-      free(shdr);
-
-
-    /************************************************************/
-    } else if (ehdr.elfclass == ELFCLASS32) {
-      // Find symbol table and string table
-      //   - shdr = malloc(); <-- on heap
-      Elf32_Shdr *shdr = NULL;
-      Elf32_Shdr *symtab = NULL;
-      Elf32_Shdr *strtab = NULL;
-      assert(findSymtabAndStrtabAndShdr_Elf32(objList[i], ehdr.ehdr.elf32_ehdr,
-					      &shdr, &symtab, &strtab) != -1);
-      prev_strtab_size = strtab->sh_size;
-
-      // Check if the symbols exist first..
-      int symcount = 0;
-      assert(checkIfSymbolsExist_Elf32(objList[i], singleSymbolIndex,
-				       singleSymbolList,
-				       keepNumSymbolIndex, keepNumSymbolList,
-				       completeSymbolIndex, completeSymbolList,
-				       symtab, strtab, &symcount) != -1);
-      if (!symcount) {
-	printf("        ^ ^ ^ continue\n\n");
-	free(shdr);
-	continue;
-      }
-
-      // Extend the string table and whatever follows after..
-      // Fix Elf header and Section header Table
-      int add_space = calculateBytesNeeded(actualSingleSymbolsIndex,
-					   actualSingleSymbolsToReplace,
-					   singleStr, SINGLESYM) +
-                      calculateBytesNeeded(actualKeepNumSymbolsIndex,
-					   actualKeepNumSymbolsToReplace,
-					   keepNumStr, KEEPNUMSYM) +
-                      calculateBytesNeeded(actualCompleteSymbolsIndex,
-					   actualCompleteSymbolsToReplace,
-					   completeStr, COMPLETESYM);
-      if (debug)
-	printf("ADD_SPACE is: %x\n", add_space);
-      assert(extendAndFixAfterStrtab_Elf32(objList[i], &(ehdr.ehdr.elf32_ehdr),
-					   &shdr, &symtab, &strtab,
-					   add_space) != -1);
-
-      // Add dmtcp symbol name(s) and update symtab
-      assert(addSymbolsAndUpdateSymtab_Elf32(objList[i], i,
-				     actualSingleSymbolsIndex,
-				     actualSingleSymbolsToReplace, symtab,
-                                     strtab, &prev_strtab_size, singleStr,
-                                     SINGLESYM) != -1);
-      assert(addSymbolsAndUpdateSymtab_Elf32(objList[i], i,
-				     actualKeepNumSymbolsIndex,
-                                     actualKeepNumSymbolsToReplace, symtab,
-                                     strtab, &prev_strtab_size, keepNumStr,
-                                     KEEPNUMSYM) != -1);
-      assert(addSymbolsAndUpdateSymtab_Elf32(objList[i], i,
-				     actualCompleteSymbolsIndex,
-                                     actualCompleteSymbolsToReplace, symtab,
-                                     strtab, &prev_strtab_size, completeStr,
-                                     COMPLETESYM) != -1);
-
-      for (int tmp_i = 0; tmp_i < actualSingleSymbolsIndex; ++tmp_i)
-	free(actualSingleSymbolsToReplace[tmp_i]);
-      for (int tmp_i = 0; tmp_i < actualKeepNumSymbolsIndex; ++tmp_i)
-	free(actualKeepNumSymbolsToReplace[tmp_i]);
-      for (int tmp_i = 0; tmp_i < actualCompleteSymbolsIndex; ++tmp_i)
-	free(actualCompleteSymbolsToReplace[tmp_i]);
-      free(shdr);
-    } else {
-      printf("ERROR: Unknown ELF Class");
-      exit(1);
+    printf("mes_open\n");
+  MesOptions defaults;
+  if (handle == NULL)
+    return MES_ERR_ARGS;
+  *handle = NULL;
+  if (opts == NULL) {
+    mes_options_init(&defaults);
+    opts = &defaults;
+  }
+  if ((unsigned)opts->select > MES_ONLY_UNDEF ||
+      (unsigned)opts->logLevel > MES_LOG_VERBOSE ||
+      (unsigned)opts->io > MES_IO_URING || opts->jobs < 0 ||
+      opts->ioDepth < -1)
+    return MES_ERR_ARGS;
+
+  static unsigned handles = 0;
+  MesHandle *h = calloc(1, sizeof(MesHandle));
+  if (h == NULL)
+    return MES_ERR_NOMEM;
+  h->id = __atomic_add_fetch(&handles, 1, __ATOMIC_RELAXED);
+  h->def_or_undef = opts->select;
+  h->logLevel = opts->logLevel;
+  h->jobs = opts->jobs ? opts->jobs : 1;
+  h->strtabAtEnd = opts->strtabAtEnd;
+  h->dynamicSymbols = opts->dynamic;
+  h->io_buffered = opts->io != MES_IO_MMAP;
+  h->ioUring = opts->io == MES_IO_URING;
+  h->ioDepth = opts->ioDepth;
+  h->commitAtomic = opts->commitAtomic;
+  h->collectRenames = opts->collectRenames;
+  h->scratchArenas = calloc(h->jobs, sizeof(Arena));
+  h->renameArenas = calloc(h->jobs, sizeof(Arena));
+  if (h->scratchArenas == NULL || h->renameArenas == NULL) {
+    mes_close(h);
+    return MES_ERR_NOMEM;
+  }
+  if (opts->cacheFile) {
+    h->cacheFile = strdup(opts->cacheFile);
+    if (h->cacheFile == NULL) {
+      mes_close(h);
+      return MES_ERR_NOMEM;
+    }
+    if (cache_load(&h->cache, h->cacheFile) == -1) {
+      mes_close(h);
+      return MES_ERR_CACHE;
     }
+    h->stats.cacheSize = h->cache.count;
   }
-  free(singleSymbolList);
-  free(keepNumSymbolList);
-  free(completeSymbolList);
+  *handle = h;
+  return MES_OK;
+}
+
+// Rename the symbols 'rules' select in the 'count' objects.  The result of
+// each goes to 'done' in order; 'outputs' (or an entry of it) is NULL for
+// objects modified in place.
+MESERROR mes_run(MesHandle *h, MesRules *rules, const char *const *objects,
+                 const char *const *outputs, int count, mes_result_fn done,
+                 void *arg) {
+  if (debug_func)
+    printf("mes_run\n");
+  if (h == NULL || rules == NULL || count < 0 || (count && objects == NULL))
+    return MES_ERR_ARGS;
+  for (int i = 0; i < count; ++i)
+    if (objects[i] == NULL)
+      return MES_ERR_ARGS;
+  if (!rules->finished) {
+    if (ruleset_finish(&rules->rs) == -1)
+      return MES_ERR_NOMEM;
+    rules->finished = 1;
+  }
+  free(h->lastLog);
+  h->lastLog = NULL;
+  for (int i = 0; i < h->jobs; ++i)
+    arena_reset(&h->renameArenas[i]);
+  memset(&h->stats, 0, sizeof(h->stats));
+  h->stopping = 0;
+  h->commits.committed = h->commits.syncs = 0;
+  if (h->cacheFile) {
+    int options[] = {h->def_or_undef, h->strtabAtEnd, h->dynamicSymbols};
+    h->rulesKey = hash64(options, sizeof(options), ruleset_hash(&rules->rs));
+  }
+
+  Arena arena = {0};
+  MesRun run = {h, NULL, done, arg, MES_OK, 0};
+  MESERROR rc = MES_OK;
+  run.ctxs = calloc(count ? count : 1, sizeof(ObjCtx));
+  if (run.ctxs == NULL)
+    return MES_ERR_NOMEM;
+  if (initObjCtxs(h, run.ctxs, count, objects, outputs, &rules->rs,
+                  &arena) == -1) {
+    free(run.ctxs);
+    arena_free(&arena);
+    return MES_ERR_NOMEM;
+  }
+
+  // Objects are independent: spread them over the workers, results are
+  // still handed over in order
+  long prefetched = 0, ringCalls = 0;
+  h->readAhead = startReadAhead(h, run.ctxs, count);
+  int pool = workpool_run(h->jobs, count, processObjectItem, emitObjectItem,
+                          &run);
+  if (pool == -1)
+    rc = MES_ERR_NOMEM;
+  else if (pool == 1)
+    dropObjectItems(&run, run.emitted, count);
+  h->stats.objects = run.emitted;
+  IORINGBACKEND backend = ioring_backend(h->readAhead);
+  ioring_stop(h->readAhead, &prefetched, &ringCalls);
+  h->readAhead = NULL;
+  if (commit_flush(&h->commits) == -1)
+    rc = MES_ERR_COMMIT;
+
+  h->stats.readAhead = backend == IORING_URING     ? MES_READAHEAD_URING
+                       : backend == IORING_FADVISE ? MES_READAHEAD_FADVISE
+                                                   : MES_READAHEAD_NONE;
+  if (h->stats.readAhead == MES_READAHEAD_NONE)
+    h->stats.ioDepth = 0;
+  h->stats.prefetched = prefetched;
+  h->stats.ringCalls = ringCalls;
+  h->stats.committed = h->commits.committed;
+  h->stats.syncs = h->commits.syncs;
+  if (h->cacheFile) {
+    if (cache_save(&h->cache, h->cacheFile) == -1 && rc == MES_OK)
+      rc = MES_ERR_CACHE;
+    h->stats.cacheSize = h->cache.count;
+  }
+  free(run.ctxs);
+  arena_free(&arena);
+  return rc != MES_OK ? rc : run.err;
+}
+
+// mes_process(): keep the result of its one object
+typedef struct {
+  MesHandle *h;
+  MesResult *result;
+} MesOne;
+
+int keepResult(const MesResult *result, int item, void *arg) {
+  MesOne *one = arg;
+  (void)item; // always 0, mes_process() runs one object
+  *one->result = *result;
+  one->h->lastLog = malloc(result->logLen + 1);
+  if (one->h->lastLog == NULL) {
+    one->result->log = "";
+    one->result->logLen = 0;
+    return 0;
+  }
+  memcpy(one->h->lastLog, result->log, result->logLen);
+  one->h->lastLog[result->logLen] = '\0';
+  one->result->log = one->h->lastLog;
+  return 0;
+}
+
+// Process one object; its log stays valid until the next run
+MESERROR mes_process(MesHandle *h, MesRules *rules, const char *object,
+                     const char *output, MesResult *result) {
+  if (result == NULL)
+    return MES_ERR_ARGS;
+  MesOne one = {h, result};
+  memset(result, 0, sizeof(*result));
+  return mes_run(h, rules, &object, output ? &output : NULL, 1, keepResult,
+                 &one);
+}
+
+void mes_stats(const MesHandle *h, MesStats *stats) {
+  *stats = h->stats;
+}
 
-  printf("\n\n%s\n\n", "Finished replace-symbols-name Program "
-                       "+++++++++++++++++++++++++++++++++");
+void mes_close(MesHandle *h) {
+  if (h == NULL)
+    return;
+  if (h->cacheFile)
+    cache_free(&h->cache);
+  commit_free(&h->commits);
+  for (int i = 0; h->scratchArenas && i < h->jobs; ++i)
+    arena_free(&h->scratchArenas[i]);
+  for (int i = 0; h->renameArenas && i < h->jobs; ++i)
+    arena_free(&h->renameArenas[i]);
+  free(h->scratchArenas);
+  free(h->renameArenas);
+  free(h->cacheFile);
+  free(h->lastLog);
+  free(h);
 }
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/report.h"
+
+static const char *status_names[] = {"ok", "cached", "failed", "skipped"};
+
+static void write_json(FILE *fp, ReportObject *objs, int count,
+                       const uint64_t *phaseNs) {
+  long renamed = 0, failed = 0, cached = 0;
+  uint64_t bytesAdded = 0;
+  fprintf(fp, "{\"objects\":[");
+  for (int i = 0; i < count; ++i) {
+    ReportObject *obj = &objs[i];
+    const uint64_t *ns = phaseNs + (size_t)i * TRACE_PHASES;
+    fprintf(fp, "%s\n{\"path\":", i ? "," : "");
+    json_string(fp, obj->path);
+    fprintf(fp, ",\"output\":");
+    if (obj->output)
+      json_string(fp, obj->output);
+    else
+      fprintf(fp, "null");
+    fprintf(fp, ",\"status\":\"%s\",\"renamed\":%d,\"bytesAdded\":%llu",
+            status_names[obj->status], obj->renamed,
+            (unsigned long long)obj->bytesAdded);
+    fprintf(fp, ",\"phaseNs\":{");
+    for (int p = 0, n = 0; p < TRACE_PHASES; ++p)
+      if (ns[p])
+        fprintf(fp, "%s\"%s\":%llu", n++ ? "," : "", trace_phase_name(p),
+                (unsigned long long)ns[p]);
+    fprintf(fp, "},\"renames\":[");
+    for (int r = 0; r + 1 < obj->renames.count; r += 2) {
+      fprintf(fp, "%s[", r ? "," : "");
+      json_string(fp, obj->renames.items[r]);
+      fputc(',', fp);
+      json_string(fp, obj->renames.items[r + 1]);
+      fputc(']', fp);
+    }
+    fprintf(fp, "]}");
+    renamed += obj->renamed;
+    bytesAdded += obj->bytesAdded;
+    failed += obj->status == REPORT_FAILED;
+    cached += obj->status == REPORT_CACHED;
+  }
+  fprintf(fp,
+          "\n],\"totals\":{\"objects\":%d,\"renamed\":%ld,\"bytesAdded\":%llu,"
+          "\"cached\":%ld,\"failed\":%ld}}\n",
+          count, renamed, (unsigned long long)bytesAdded, cached, failed);
+}
+
+static void put_le(FILE *fp, uint64_t value, int size) {
+  for (int i = 0; i < size; ++i)
+    fputc((value >> (8 * i)) & 0xff, fp);
+}
+
+static void put_string(FILE *fp, const char *str) {
+  size_t len = str ? strlen(str) : 0;
+  put_le(fp, len, 4);
+  fwrite(str, 1, len, fp);
+}
+
+static void write_binary(FILE *fp, ReportObject *objs, int count,
+                         const uint64_t *phaseNs) {
+  fwrite(REPORT_MAGIC, 1, strlen(REPORT_MAGIC), fp);
+  put_le(fp, count, 4);
+  put_le(fp, TRACE_PHASES, 4);
+  for (int p = 0; p < TRACE_PHASES; ++p)
+    put_string(fp, trace_phase_name(p));
+  for (int i = 0; i < count; ++i) {
+    ReportObject *obj = &objs[i];
+    put_string(fp, obj->path);
+    put_string(fp, obj->output);
+    put_le(fp, obj->status, 1);
+    put_le(fp, obj->renamed, 4);
+    put_le(fp, obj->bytesAdded, 8);
+    for (int p = 0; p < TRACE_PHASES; ++p)
+      put_le(fp, phaseNs[(size_t)i * TRACE_PHASES + p], 8);
+    put_le(fp, obj->renames.count / 2, 4);
+    for (int r = 0; r < obj->renames.count; ++r)
+      put_string(fp, obj->renames.items[r]);
+  }
+}
+
+// Write the report on 'objs' to 'fd'.  It is put together in memory and
+// handed over with one write, so that a reader never sees half of it.
+// 'phaseNs' holds TRACE_PHASES times per object.
+int report_write(int fd, REPORTFORMAT format, ReportObject *objs, int count,
+                 const uint64_t *phaseNs) {
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *fp = open_memstream(&buf, &len);
+  if (fp == NULL) {
+    perror("open_memstream");
+    return -1;
+  }
+  if (format == REPORT_JSON)
+    write_json(fp, objs, count, phaseNs);
+  else
+    write_binary(fp, objs, count, phaseNs);
+  int rc = -1;
+  if (fclose(fp) == 0 && writeall(fd, buf, len) != -1)
+    rc = 0;
+  free(buf);
+  return rc;
+}
@@ -0,0 +1,171 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/rules.h"
+
+int ruleset_add(RuleSet *rs, const char *name, const char *str, FLAGTYPE ft) {
+  if (rs->count == rs->cap) {
+    int cap = rs->cap ? rs->cap * 2 : 64;
+    Rule *rules = arena_grow(&rs->arena, rs->rules, rs->cap * sizeof(Rule),
+                             cap * sizeof(Rule));
+    if (rules == NULL)
+      return -1;
+    rs->rules = rules;
+    rs->cap = cap;
+  }
+  Rule *rule = &rs->rules[rs->count];
+  rule->name = arena_strdup(&rs->arena, name);
+  rule->str = str ? arena_strdup(&rs->arena, str) : NULL;
+  rule->ft = ft;
+  rule->type = MATCH_EXACT;
+  if (rule->name == NULL || (str && rule->str == NULL))
+    return -1;
+  rs->countByFt[ft]++;
+  rs->count++;
+  return 0;
+}
+
+// Append 'str' to every symbol selected by 'pattern'
+int ruleset_add_pattern(RuleSet *rs, MATCHTYPE type, const char *pattern,
+                        const char *str) {
+  if (ruleset_add(rs, pattern, str, SINGLESYM) == -1)
+    return -1;
+  rs->rules[rs->count - 1].type = type;
+  rs->patternCount++;
+  return 0;
+}
+
+// Rule for symbol 'name': an exact rule if there is one, else the first
+// pattern rule matching it.  -1 if no rule applies.
+int ruleset_lookup(const RuleSet *rs, const char *name, size_t maxlen) {
+  int rule = symindex_find_n(&rs->index, name, maxlen);
+  if (rule == -1 && rs->patternCount)
+    rule = matcher_match(&rs->matcher, name, maxlen);
+  return rule;
+}
+
+// Split 'line' in place into at most 'max' whitespace separated tokens
+static int split_tokens(char *line, char **tok, int max) {
+  int n = 0;
+  char *save = NULL;
+  for (char *t = strtok_r(line, " \t\r\n", &save); t != NULL;
+       t = strtok_r(NULL, " \t\r\n", &save)) {
+    if (n == max)
+      return max + 1;
+    tok[n++] = t;
+  }
+  return n;
+}
+
+// One line of a rules file; '#' starts a comment:
+//   OLD NEW               rename OLD to NEW
+//   rename OLD NEW        same
+//   append OLD SUFFIX     OLD -> OLD<SUFFIX>
+//   number OLD SEPARATOR  OLD -> OLD<SEPARATOR><object number>
+//   prefix P SUFFIX       every symbol starting with P -> <name><SUFFIX>
+//   suffix P SUFFIX       every symbol ending with P -> <name><SUFFIX>
+//   glob P SUFFIX         every symbol matching fnmatch(3) P -> <name><SUFFIX>
+// 'line' is split in place.  Errors are reported as 'where:lineno'.
+int ruleset_add_line(RuleSet *rs, char *line, const char *where, int lineno) {
+  char *tok[3];
+  char *hash = strchr(line, '#');
+  if (hash)
+    *hash = '\0';
+  int n = split_tokens(line, tok, 3);
+  if (n == 0)
+    return 0;
+  if (n == 2)
+    return ruleset_add(rs, tok[0], tok[1], COMPLETESYM);
+  if (n == 3 && strcmp(tok[0], "rename") == 0)
+    return ruleset_add(rs, tok[1], tok[2], COMPLETESYM);
+  if (n == 3 && strcmp(tok[0], "append") == 0)
+    return ruleset_add(rs, tok[1], tok[2], SINGLESYM);
+  if (n == 3 && strcmp(tok[0], "number") == 0)
+    return ruleset_add(rs, tok[1], tok[2], KEEPNUMSYM);
+  if (n == 3 && strcmp(tok[0], "prefix") == 0)
+    return ruleset_add_pattern(rs, MATCH_PREFIX, tok[1], tok[2]);
+  if (n == 3 && strcmp(tok[0], "suffix") == 0)
+    return ruleset_add_pattern(rs, MATCH_SUFFIX, tok[1], tok[2]);
+  if (n == 3 && strcmp(tok[0], "glob") == 0)
+    return ruleset_add_pattern(rs, MATCH_GLOB, tok[1], tok[2]);
+  fprintf(stderr, "%s:%d: expected 'OLD NEW' or "
+                  "'rename|append|number|prefix|suffix|glob OLD STRING'\n",
+          where, lineno);
+  return -1;
+}
+
+// Rules file, one rule per line as described above
+int ruleset_load_file(RuleSet *rs, const char *path) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+  char *line = NULL;
+  size_t linecap = 0;
+  int lineno = 0;
+  int rc = 0;
+
+  while (rc == 0 && getline(&line, &linecap, fp) != -1)
+    rc = ruleset_add_line(rs, line, path, ++lineno);
+  if (ferror(fp)) {
+    perror(path);
+    rc = -1;
+  }
+  free(line);
+  fclose(fp);
+  return rc;
+}
+
+// Index the exact rules by name and compile the pattern rules.  When
+// several rules select the same symbol the first one wins, and exact rules
+// win over patterns.
+int ruleset_finish(RuleSet *rs) {
+  if (symindex_init(&rs->index, rs->count) == -1)
+    return -1;
+  rs->keepNumRules =
+      arena_alloc(&rs->arena, (rs->countByFt[KEEPNUMSYM] + 1) * sizeof(int));
+  if (rs->keepNumRules == NULL)
+    return -1;
+  rs->keepNumCount = 0;
+  for (int i = 0; i < rs->count; ++i) {
+    if (rs->rules[i].type != MATCH_EXACT) {
+      if (matcher_add(&rs->matcher, rs->rules[i].type, rs->rules[i].name, i) ==
+          -1)
+        return -1;
+      continue;
+    }
+    symindex_add(&rs->index, i, rs->rules[i].name, (size_t)-1);
+    if (rs->rules[i].ft == KEEPNUMSYM)
+      rs->keepNumRules[rs->keepNumCount++] = i;
+  }
+  if (rs->patternCount && matcher_compile(&rs->matcher) == -1)
+    return -1;
+  return 0;
+}
+
+// Hash of everything the rules would do to an object, for recognising
+// objects already processed with the same rules
+uint64_t ruleset_hash(const RuleSet *rs) {
+  uint64_t h = hash64(&rs->count, sizeof(rs->count), 0);
+  for (int i = 0; i < rs->count; ++i) {
+    const Rule *rule = &rs->rules[i];
+    int kind[2] = {rule->ft, rule->type};
+    h = hash64(kind, sizeof(kind), h);
+    h = hash64(rule->name, strlen(rule->name) + 1, h);
+    if (rule->str)
+      h = hash64(rule->str, strlen(rule->str) + 1, h);
+    else
+      h = hash64("", 0, h); // the defaults
+  }
+  return h;
+}
+
+void ruleset_free(RuleSet *rs) {
+  symindex_free(&rs->index);
+  matcher_free(&rs->matcher);
+  arena_free(&rs->arena);
+  memset(rs, 0, sizeof(*rs));
+}
@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/server.h"
+
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    printf("*** ***Socket path %s is too long.\n", path);
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+// Remove 'path' if it is a socket nobody listens on any more.  Anything
+// else there, a live socket or a file that is not a socket, is left alone.
+static int remove_stale_socket(const char *path,
+                               const struct sockaddr_un *addr) {
+  struct stat st;
+  if (lstat(path, &st) == -1) {
+    if (errno == ENOENT)
+      return 0;
+    perror(path);
+    return -1;
+  }
+  if (!S_ISSOCK(st.st_mode)) {
+    printf("*** ***%s exists and is not a socket.\n", path);
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("socket");
+    return -1;
+  }
+  int live = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+  close(fd);
+  if (live) {
+    printf("*** ***%s: address in use.\n", path);
+    return -1;
+  }
+  if (unlink(path) == -1 && errno != ENOENT) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+// Listen on the Unix socket 'path', replacing a stale socket file
+int server_listen(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_address(path, &addr) == -1 ||
+      remove_stale_socket(path, &addr) == -1)
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("socket");
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(fd, 16) == -1) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int client_connect(const char *path) {
+  struct sockaddr_un addr;
+  if (unix_address(path, &addr) == -1)
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("socket");
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Next line without its '\n', NULL at end of input.  The line stays valid
+// until the next call.
+char *line_read(LineReader *lr) {
+  for (;;) {
+    char *nl = memchr(lr->buf + lr->pos, '\n', lr->len - lr->pos);
+    if (nl != NULL) {
+      char *line = lr->buf + lr->pos;
+      *nl = '\0';
+      lr->pos = nl + 1 - lr->buf;
+      return line;
+    }
+    // Keep the partial line, make room and read more
+    memmove(lr->buf, lr->buf + lr->pos, lr->len - lr->pos);
+    lr->len -= lr->pos;
+    lr->pos = 0;
+    if (lr->len == lr->cap) {
+      size_t cap = lr->cap ? lr->cap * 2 : 4096;
+      char *buf = realloc(lr->buf, cap);
+      if (buf == NULL)
+        return NULL;
+      lr->buf = buf;
+      lr->cap = cap;
+    }
+    ssize_t rc = read(lr->fd, lr->buf + lr->len, lr->cap - lr->len);
+    if (rc == -1 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      return NULL;
+    lr->len += rc;
+  }
+}
+
+void line_reader_free(LineReader *lr) {
+  free(lr->buf);
+  memset(lr, 0, sizeof(*lr));
+  lr->fd = -1;
+}
+
+int sock_printf(int fd, const char *fmt, ...) {
+  char small[512];
+  char *buf = small;
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(small, sizeof(small), fmt, ap);
+  va_end(ap);
+  if (len < 0)
+    return -1;
+  if ((size_t)len >= sizeof(small)) {
+    buf = malloc(len + 1);
+    if (buf == NULL)
+      return -1;
+    va_start(ap, fmt);
+    vsnprintf(buf, len + 1, fmt, ap);
+    va_end(ap);
+  }
+  int rc = 0;
+  for (char *p = buf; len > 0;) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      rc = -1;
+      break;
+    }
+    p += n;
+    len -= n;
+  }
+  if (buf != small)
+    free(buf);
+  return rc;
+}
+
+// FNV-1a, 64 bit; start from 0
+uint64_t job_key_update(uint64_t key, const void *data, size_t len) {
+  const unsigned char *p = data;
+  if (key == 0)
+    key = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; ++i) {
+    key ^= p[i];
+    key *= 0x100000001b3ULL;
+  }
+  return key;
+}
+
+MesRules *rule_cache_get(RuleCache *cache, uint64_t key) {
+  for (int i = 0; i < RULE_CACHE_SIZE; ++i) {
+    RuleCacheEntry *e = &cache->entries[i];
+    if (e->lastUse != 0 && e->key == key) {
+      e->lastUse = ++cache->clock;
+      cache->hits++;
+      return e->rules;
+    }
+  }
+  cache->misses++;
+  return NULL;
+}
+
+// Keep 'rules', built for 'key', in a free slot or the least recently
+// used one; the cache owns them from now on
+void rule_cache_put(RuleCache *cache, uint64_t key, MesRules *rules) {
+  RuleCacheEntry *victim = &cache->entries[0];
+  for (int i = 0; i < RULE_CACHE_SIZE; ++i) {
+    RuleCacheEntry *e = &cache->entries[i];
+    if (e->lastUse < victim->lastUse)
+      victim = e;
+  }
+  if (victim->lastUse != 0)
+    mes_rules_free(victim->rules);
+  victim->rules = rules;
+  victim->key = key;
+  victim->lastUse = ++cache->clock;
+}
+
+void rule_cache_free(RuleCache *cache) {
+  for (int i = 0; i < RULE_CACHE_SIZE; ++i)
+    if (cache->entries[i].lastUse != 0)
+      mes_rules_free(cache->entries[i].rules);
+  memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/strtab.h"
+
+// FNV-1a fed from the last character backwards, so the hash of every
+// suffix of a string falls out of a single backward walk.
+#define REV_HASH_INIT 2166136261u
+#define REV_HASH_STEP(h, c) (((h) ^ (unsigned char)(c)) * 16777619u)
+
+static const char *strtab_at(StrtabBuilder *sb, unsigned long offset) {
+  if (offset < sb->size)
+    return sb->base + offset;
+  return sb->added + (offset - sb->size);
+}
+
+static int strtab_grow_slots(StrtabBuilder *sb);
+
+static StrtabSlot *strtab_slot(StrtabBuilder *sb, const char *str,
+                               unsigned int hash, size_t len) {
+  StrtabSlot *slot;
+  for (size_t pos = hash & sb->mask;; pos = (pos + 1) & sb->mask) {
+    slot = &sb->slots[pos];
+    if (slot->offset == 0)
+      return slot;
+    if (slot->hash == hash && slot->len == len &&
+        memcmp(strtab_at(sb, slot->offset), str, len) == 0)
+      return slot;
+  }
+}
+
+static int strtab_insert(StrtabBuilder *sb, unsigned int hash, size_t len,
+                         unsigned long offset) {
+  if ((sb->used + 1) * 2 > sb->mask + 1 && strtab_grow_slots(sb) == -1)
+    return -1;
+  StrtabSlot *slot = strtab_slot(sb, strtab_at(sb, offset), hash, len);
+  if (slot->offset == 0) {
+    slot->hash = hash;
+    slot->len = len;
+    slot->offset = offset;
+    sb->used++;
+  }
+  return 0;
+}
+
+static int strtab_grow_slots(StrtabBuilder *sb) {
+  StrtabSlot *old = sb->slots;
+  size_t nslots = sb->mask + 1;
+  sb->slots = arena_calloc(sb->arena, nslots * 2, sizeof(StrtabSlot));
+  if (sb->slots == NULL) {
+    sb->slots = old;
+    return -1;
+  }
+  sb->mask = nslots * 2 - 1;
+  sb->used = 0;
+  for (size_t i = 0; i < nslots; ++i)
+    if (old[i].offset != 0)
+      strtab_insert(sb, old[i].hash, old[i].len, old[i].offset);
+  return 0;
+}
+
+// Register the suffixes of the string at 'offset' whose length is wanted
+static int strtab_add_suffixes(StrtabBuilder *sb, unsigned long offset,
+                               size_t len) {
+  const char *str = strtab_at(sb, offset);
+  unsigned int hash = REV_HASH_INIT;
+  for (size_t l = 1; l <= len && l <= sb->max_len; ++l) {
+    hash = REV_HASH_STEP(hash, str[len - l]);
+    if (sb->want[l] && strtab_insert(sb, hash, l, offset + len - l) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+// Strings starting at one of the (ascending) 'skip' offsets are about to be
+// overwritten and are never handed out.
+int strtab_builder_init(StrtabBuilder *sb, Arena *arena, const char *base,
+                        unsigned long size, char **names, size_t count,
+                        const unsigned long *skip, size_t nskip) {
+  memset(sb, 0, sizeof(*sb));
+  sb->arena = arena;
+  sb->base = base;
+  sb->size = size;
+
+  for (size_t i = 0; i < count; ++i)
+    if (strlen(names[i]) > sb->max_len)
+      sb->max_len = strlen(names[i]);
+  sb->want = arena_calloc(arena, sb->max_len + 1, 1);
+  sb->slots = arena_calloc(arena, 64, sizeof(StrtabSlot));
+  if (sb->want == NULL || sb->slots == NULL)
+    return -1;
+  sb->mask = 63;
+  for (size_t i = 0; i < count; ++i)
+    sb->want[strlen(names[i])] = 1;
+
+  // One sweep over the existing table, string by string
+  unsigned long start = 0;
+  for (unsigned long pos = 0; pos < size; ++pos) {
+    if (base[pos] != '\0')
+      continue;
+    while (nskip > 0 && *skip < start) {
+      skip++;
+      nskip--;
+    }
+    if (pos > start && !(nskip > 0 && *skip == start) &&
+        strtab_add_suffixes(sb, start, pos - start) == -1)
+      return -1;
+    start = pos + 1;
+  }
+  return 0;
+}
+
+// Longer strings sharing a tail with shorter ones have to be placed first
+static int strtab_compare_reversed(const void *a, const void *b) {
+  const char *sa = *(char *const *)a;
+  const char *sb = *(char *const *)b;
+  const char *pa = sa + strlen(sa);
+  const char *pb = sb + strlen(sb);
+  while (pa > sa && pb > sb) {
+    --pa;
+    --pb;
+    if (*pa != *pb)
+      return (unsigned char)*pb - (unsigned char)*pa;
+  }
+  return (pb > sb) - (pa > sa);
+}
+
+static long strtab_intern(StrtabBuilder *sb, const char *name) {
+  size_t len = strlen(name);
+  if (len == 0)
+    return 0;
+  unsigned int hash = REV_HASH_INIT;
+  for (size_t l = len; l > 0; --l)
+    hash = REV_HASH_STEP(hash, name[l - 1]);
+  StrtabSlot *slot = strtab_slot(sb, name, hash, len);
+  if (slot->offset != 0 && strtab_at(sb, slot->offset)[len] == '\0')
+    return slot->offset;
+
+  // Truly new: append it
+  if (sb->added_len + len + 1 > sb->added_cap) {
+    size_t cap = sb->added_cap ? sb->added_cap * 2 : 256;
+    while (cap < sb->added_len + len + 1)
+      cap *= 2;
+    char *added = arena_grow(sb->arena, sb->added, sb->added_cap, cap);
+    if (added == NULL)
+      return -1;
+    sb->added = added;
+    sb->added_cap = cap;
+  }
+  unsigned long offset = sb->size + sb->added_len;
+  memcpy(sb->added + sb->added_len, name, len + 1);
+  sb->added_len += len + 1;
+  if (strtab_add_suffixes(sb, offset, len) == -1)
+    return -1;
+  return offset;
+}
+
+// offsets[i] receives the final string table offset of names[i]
+int strtab_intern_all(StrtabBuilder *sb, char **names, size_t count,
+                      unsigned long *offsets) {
+  char **order = arena_alloc(sb->arena, count * sizeof(char *));
+  if (order == NULL)
+    return -1;
+  memcpy(order, names, count * sizeof(char *));
+  qsort(order, count, sizeof(char *), strtab_compare_reversed);
+  for (size_t i = 0; i < count; ++i)
+    if (strtab_intern(sb, order[i]) == -1)
+      return -1;
+
+  // Everything is interned now, so these are plain lookups
+  for (size_t i = 0; i < count; ++i) {
+    long offset = strtab_intern(sb, names[i]);
+    if (offset == -1)
+      return -1;
+    offsets[i] = offset;
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/symindex.h"
+#include "../include/util.h"
+
+// Measures the name too.  strnlen() is glibc's, which picks a vector
+// implementation at load time; hash64() then takes the name 8 bytes at a
+// time rather than one.  Splitting the whole string table at its NULs
+// first, with SSE2/AVX2 kernels, and hashing each string in that sweep was
+// no faster: the hash is most of the cost, and strnlen() already runs on
+// vectors.  `make bench` reports the time this phase takes ("ms lookup").
+unsigned int symindex_hash(const char *name, size_t maxlen, size_t *len) {
+  *len = strnlen(name, maxlen);
+  return (unsigned int)hash64(name, *len, 0);
+}
+
+int symindex_init(SymIndex *idx, size_t nsyms) {
+  size_t nslots = 16;
+  // Keep the load factor at or below 1/2
+  while (nslots < nsyms * 2)
+    nslots <<= 1;
+  idx->slots = calloc(nslots, sizeof(SymIndexSlot));
+  idx->next = malloc((nsyms ? nsyms : 1) * sizeof(long));
+  if (idx->slots == NULL || idx->next == NULL) {
+    perror("symindex_init");
+    free(idx->slots);
+    free(idx->next);
+    return -1;
+  }
+  idx->mask = nslots - 1;
+  idx->nsyms = nsyms;
+  return 0;
+}
+
+static SymIndexSlot *symindex_slot(const SymIndex *idx, const char *name,
+                                   unsigned int hash, size_t len) {
+  SymIndexSlot *slot;
+  for (size_t pos = hash & idx->mask;; pos = (pos + 1) & idx->mask) {
+    slot = &idx->slots[pos];
+    if (slot->name == NULL)
+      return slot;
+    if (slot->hash == hash && slot->len == len &&
+        memcmp(slot->name, name, len) == 0)
+      return slot;
+  }
+}
+
+// Symbols must be added in increasing index order; each name keeps its
+// symbols in that order.
+void symindex_add(SymIndex *idx, long symidx, const char *name,
+                  size_t maxlen) {
+  size_t len;
+  unsigned int hash = symindex_hash(name, maxlen, &len);
+  SymIndexSlot *slot = symindex_slot(idx, name, hash, len);
+
+  idx->next[symidx] = -1;
+  if (slot->name == NULL) {
+    slot->hash = hash;
+    slot->len = len;
+    slot->name = name;
+    slot->first = symidx;
+  } else {
+    idx->next[slot->last] = symidx;
+  }
+  slot->last = symidx;
+}
+
+long symindex_find(const SymIndex *idx, const char *name) {
+  return symindex_find_n(idx, name, (size_t)-1);
+}
+
+// Same, for a name that may run into the end of its table after maxlen bytes
+long symindex_find_n(const SymIndex *idx, const char *name, size_t maxlen) {
+  size_t len;
+  unsigned int hash = symindex_hash(name, maxlen, &len);
+  SymIndexSlot *slot = symindex_slot(idx, name, hash, len);
+  return slot->name ? slot->first : -1;
+}
+
+void symindex_free(SymIndex *idx) {
+  free(idx->slots);
+  free(idx->next);
+  idx->slots = NULL;
+  idx->next = NULL;
+}
@@ -0,0 +1,193 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/trace.h"
+#include "../include/util.h"
+
+int trace_enabled = 0;
+
+static const char *phase_names[TRACE_PHASES] = {
+    "processObject",
+    "checkAndFindElfFile",
+    "findSymtabAndStrtabAndShdr",
+    "checkIfSymbolsExist",
+    "planStrtab",
+    "write_shifted_copy",
+    "extendAndFixAfterStrtab",
+    "addSymbolsAndUpdateSymtab",
+    "rehashDynsym",
+    "writeArchive",
+    "unmap_file",
+    "commit"};
+
+// One finished phase
+typedef struct {
+  TRACEPHASE phase;
+  int tid;
+  int object;
+  uint64_t start; // ns, CLOCK_MONOTONIC
+  uint64_t dur;   // ns
+  TraceCounters counters;
+} TraceEvent;
+
+static __thread TraceCounters thread_counters;
+static __thread int thread_id = 0; // 0: not assigned yet
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceEvent *events = NULL;
+static size_t event_count = 0;
+static size_t event_cap = 0;
+static int thread_count = 0;
+static uint64_t epoch = 0; // earliest start, time 0 of the trace
+
+const char *trace_phase_name(TRACEPHASE phase) { return phase_names[phase]; }
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Account for I/O done by the calling thread; cheap enough to be called
+// whether or not tracing is on
+void trace_io(uint64_t read, uint64_t written, uint64_t syscalls) {
+  thread_counters.bytesRead += read;
+  thread_counters.bytesWritten += written;
+  thread_counters.syscalls += syscalls;
+}
+
+void trace_begin(TraceSpan *span, TRACEPHASE phase) {
+  if (!trace_enabled)
+    return;
+  span->phase = phase;
+  span->counters = thread_counters;
+  span->start = now_ns();
+}
+
+// Close 'span' and record it against object number 'object'
+void trace_end(TraceSpan *span, int object) {
+  if (!trace_enabled)
+    return;
+  TraceEvent ev;
+  uint64_t end = now_ns();
+  ev.phase = span->phase;
+  ev.object = object;
+  ev.dur = end - span->start;
+  ev.counters.bytesRead =
+      thread_counters.bytesRead - span->counters.bytesRead;
+  ev.counters.bytesWritten =
+      thread_counters.bytesWritten - span->counters.bytesWritten;
+  ev.counters.syscalls = thread_counters.syscalls - span->counters.syscalls;
+
+  pthread_mutex_lock(&trace_lock);
+  if (thread_id == 0)
+    thread_id = ++thread_count;
+  if (epoch == 0 || span->start < epoch)
+    epoch = span->start;
+  ev.tid = thread_id;
+  ev.start = span->start;
+  if (event_count == event_cap) {
+    size_t cap = event_cap ? event_cap * 2 : 1024;
+    TraceEvent *grown = realloc(events, cap * sizeof(TraceEvent));
+    if (grown == NULL) {
+      pthread_mutex_unlock(&trace_lock);
+      return; // drop the event rather than the run
+    }
+    events = grown;
+    event_cap = cap;
+  }
+  events[event_count++] = ev;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+// Write the events in Chrome's trace event format ("X" complete events,
+// times in us), loadable in chrome://tracing and Perfetto.  'objects'
+// names the object numbers events were recorded against.
+int trace_write_chrome(const char *path, char **objects, int count) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < event_count; ++i) {
+    TraceEvent *ev = &events[i];
+    fprintf(fp,
+            "%s{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"object\":",
+            i ? ",\n" : "", phase_names[ev->phase], ev->tid,
+            (ev->start - epoch) / 1000.0, ev->dur / 1000.0);
+    if (ev->object >= 0 && ev->object < count)
+      json_string(fp, objects[ev->object]);
+    else
+      fprintf(fp, "%d", ev->object);
+    fprintf(fp,
+            ",\"bytesRead\":%llu,\"bytesWritten\":%llu,\"syscalls\":%llu}}",
+            (unsigned long long)ev->counters.bytesRead,
+            (unsigned long long)ev->counters.bytesWritten,
+            (unsigned long long)ev->counters.syscalls);
+  }
+  fprintf(fp, "\n]}\n");
+  if (fclose(fp) == EOF) {
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
+
+// Time spent in each phase by each of 'count' objects, summed into
+// phaseNs[object * TRACE_PHASES + phase]; safe while workers still run
+void trace_object_totals(uint64_t *phaseNs, int count) {
+  pthread_mutex_lock(&trace_lock);
+  for (size_t i = 0; i < event_count; ++i)
+    if (events[i].object >= 0 && events[i].object < count)
+      phaseNs[(size_t)events[i].object * TRACE_PHASES + events[i].phase] +=
+          events[i].dur;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Per phase: how often it ran, its total and p50/p99 time and the I/O it
+// did
+void trace_print_stats(void) {
+  uint64_t *durs = malloc((event_count ? event_count : 1) * sizeof(uint64_t));
+  if (durs == NULL)
+    return;
+  printf("%-27s %7s %10s %10s %10s %12s %12s %9s\n", "Phase", "Count",
+         "Total ms", "p50 us", "p99 us", "Read KB", "Written KB", "Syscalls");
+  for (int p = 0; p < TRACE_PHASES; ++p) {
+    size_t n = 0;
+    uint64_t total = 0;
+    TraceCounters sum = {0};
+    for (size_t i = 0; i < event_count; ++i) {
+      if (events[i].phase != p)
+        continue;
+      durs[n++] = events[i].dur;
+      total += events[i].dur;
+      sum.bytesRead += events[i].counters.bytesRead;
+      sum.bytesWritten += events[i].counters.bytesWritten;
+      sum.syscalls += events[i].counters.syscalls;
+    }
+    if (n == 0)
+      continue;
+    qsort(durs, n, sizeof(uint64_t), compare_u64);
+    printf("%-27s %7zu %10.3f %10.1f %10.1f %12.1f %12.1f %9llu\n",
+           phase_names[p], n, total / 1e6, durs[(n - 1) * 50 / 100] / 1e3,
+           durs[(n - 1) * 99 / 100] / 1e3, sum.bytesRead / 1024.0,
+           sum.bytesWritten / 1024.0, (unsigned long long)sum.syscalls);
+  }
+  free(durs);
+}
+
+void trace_free(void) {
+  free(events);
+  events = NULL;
+  event_count = event_cap = 0;
+}
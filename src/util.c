@@ -1,32 +1,30 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "../include/ioring.h"
+#include "../include/trace.h"
+#include "../include/util.h"
+
 int str_starts_with(const char *symbol, const char *prefix) {
-  for (;; symbol++, prefix++) {
-    if (*prefix == '\0')
-      return 1;
-    if (*symbol != *prefix)
-      return 0;
-  }
+  return strncmp(symbol, prefix, strlen(prefix)) == 0;
 }
 
 int str_ends_with(const char *symbol, const char *suffix) {
-  const char *symbol_char = symbol + strlen(symbol) - 1;
-  const char *suffix_char = suffix + strlen(suffix) - 1;
-  for (; symbol_char >= symbol || suffix_char >= suffix;
-       symbol_char--, suffix_char--) {
-    if (suffix_char == suffix)
-      return 1;
-    if (*symbol_char != *suffix_char)
-      return 0;
-  }
-  return 0;
+  size_t symbol_len = strlen(symbol), suffix_len = strlen(suffix);
+  return suffix_len <= symbol_len &&
+         memcmp(symbol + symbol_len - suffix_len, suffix, suffix_len) == 0;
 }
 
 int str_index(const char *string, char c) {
@@ -38,19 +36,103 @@ int str_index(const char *string, char c) {
   return -1;
 }
 
+// DT_GNU_HASH hash function
+uint32_t elf_gnu_hash(const char *name) {
+  uint32_t h = 5381;
+  for (const unsigned char *p = (const unsigned char *)name; *p; ++p)
+    h = h * 33 + *p;
+  return h;
+}
+
+// DT_HASH hash function from the SysV ABI
+uint32_t elf_sysv_hash(const char *name) {
+  uint32_t h = 0, g;
+  for (const unsigned char *p = (const unsigned char *)name; *p; ++p) {
+    h = (h << 4) + *p;
+    g = h & 0xf0000000;
+    if (g)
+      h ^= g >> 24;
+    h &= ~g;
+  }
+  return h;
+}
+
+#define HASH_P1 11400714785074694791ULL
+#define HASH_P2 14029467366897019727ULL
+#define HASH_P3 1609587929392839161ULL
+#define HASH_P4 9650029242287828579ULL
+#define HASH_P5 2870177450012600261ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+  return rotl64(acc + input * HASH_P2, 31) * HASH_P1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t v) {
+  return (acc ^ hash_round(0, v)) * HASH_P1 + HASH_P4;
+}
+
+// 64 bit non-cryptographic hash of 'len' bytes, XXH64's construction: four
+// independent lanes over 32 byte stripes, so whole objects hash at memory
+// speed
+uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+  const unsigned char *p = data, *end = p + len;
+  uint64_t h, w;
+  uint32_t w32;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + HASH_P1 + HASH_P2, v2 = seed + HASH_P2;
+    uint64_t v3 = seed, v4 = seed - HASH_P1;
+    for (; p + 32 <= end; p += 32) {
+      uint64_t lane[4];
+      memcpy(lane, p, 32);
+      v1 = hash_round(v1, lane[0]);
+      v2 = hash_round(v2, lane[1]);
+      v3 = hash_round(v3, lane[2]);
+      v4 = hash_round(v4, lane[3]);
+    }
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = hash_merge(hash_merge(hash_merge(hash_merge(h, v1), v2), v3), v4);
+  } else {
+    h = seed + HASH_P5;
+  }
+  h += len;
+  for (; p + 8 <= end; p += 8) {
+    memcpy(&w, p, 8);
+    h = rotl64(h ^ hash_round(0, w), 27) * HASH_P1 + HASH_P4;
+  }
+  if (p + 4 <= end) {
+    memcpy(&w32, p, 4);
+    h = rotl64(h ^ (w32 * HASH_P1), 23) * HASH_P2 + HASH_P3;
+    p += 4;
+  }
+  for (; p < end; ++p)
+    h = rotl64(h ^ (*p * HASH_P5), 11) * HASH_P1;
+  h ^= h >> 33;
+  h *= HASH_P2;
+  h ^= h >> 29;
+  h *= HASH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
 int readall(int fd, char *addr, size_t size) {
   int rc;
   while (1) {
     rc = read(fd, addr, size);
+    trace_io(rc > 0 ? rc : 0, 0, 1);
     if (rc == size)
       return rc;
     if (rc == -1) {
       perror("read");
-      exit(1);
+      return -1;
     }
     if (rc == 0) {
-      printf("readall: end of file\n");
-      exit(1);
+      fprintf(stderr, "readall: end of file\n");
+      return -1;
     }
     assert(rc > 0 && rc < size);
     size -= rc;
@@ -61,49 +143,558 @@ int writeall(int fd, char *addr, size_t size) {
   int rc;
   while (1) {
     rc = write(fd, addr, size);
+    trace_io(0, rc > 0 ? rc : 0, 1);
     if (rc == size)
       return rc;
     if (rc == -1) {
-      perror("read");
-      exit(1);
+      perror("write");
+      return -1;
     }
     if (rc == 0) {
-      printf("readall: end of file\n");
-      exit(1);
+      fprintf(stderr, "writeall: end of file\n");
+      return -1;
     }
     assert(rc > 0 && rc < size);
     size -= rc;
     addr += rc;
   }
 }
+int pwriteall(int fd, const char *addr, size_t size, off_t off) {
+  while (size > 0) {
+    ssize_t rc = pwrite(fd, addr, size, off);
+    trace_io(0, rc > 0 ? rc : 0, 1);
+    if (rc <= 0)
+      return -1;
+    size -= rc;
+    addr += rc;
+    off += rc;
+  }
+  return 0;
+}
 
-void read_metadata(char *file, char *addr, size_t size, off_t offset) {
-  int fd = open(file, O_RDONLY);
-  if (fd == -1) {
+// Largest piece of one iovec, and iovecs per preadv/pwritev call
+#define IO_CHUNK (1UL << 30)
+#define IO_IOVECS 64
+// Clean bytes between two dirty ranges that are rewritten rather than
+// spending another call on the second range
+#define FLUSH_GAP 4096
+
+// Describe [addr, addr + len) as iovecs of at most IO_CHUNK bytes
+static int fill_iovecs(struct iovec *iov, char *addr, size_t len) {
+  int n = 0;
+  for (; n < IO_IOVECS && len > 0; ++n) {
+    size_t chunk = len < IO_CHUNK ? len : IO_CHUNK;
+    iov[n].iov_base = addr;
+    iov[n].iov_len = chunk;
+    addr += chunk;
+    len -= chunk;
+  }
+  return n;
+}
+
+// The buffered variant of map_file(): the whole file is read into
+// private memory through the descriptor that later writes it back
+static int read_buffered(MappedFile *mf) {
+  struct iovec iov[IO_IOVECS];
+  mf->addr = mmap(NULL, mf->size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mf->addr == MAP_FAILED) {
+    perror("mmap");
+    close(mf->fd);
+    return -1;
+  }
+  trace_io(0, 0, 3); // open, fstat and mmap
+  for (size_t done = 0; done < mf->size;) {
+    int n = fill_iovecs(iov, mf->addr + done, mf->size - done);
+    ssize_t rc = preadv(mf->fd, iov, n, done);
+    trace_io(rc > 0 ? rc : 0, 0, 1);
+    if (rc <= 0) {
+      if (rc == 0)
+        fprintf(stderr, "map_file: %s shrank while being read\n", mf->path);
+      else
+        perror("preadv");
+      munmap(mf->addr, mf->size);
+      close(mf->fd);
+      return -1;
+    }
+    done += rc;
+  }
+  mf->buffered = 1;
+  mf->disk_size = mf->size;
+  return 0;
+}
+
+// Map 'file', or with 'buffered' read it into memory; a writable buffered
+// image is written back by flush_mapped_file()
+int map_file(char *file, MappedFile *mf, int writable, int buffered) {
+  struct stat st;
+  memset(mf, 0, sizeof(*mf));
+  mf->path = file;
+  mf->writable = writable;
+  mf->fd = open(file, writable ? O_RDWR : O_RDONLY);
+  if (mf->fd == -1 && writable &&
+      (errno == EACCES || errno == EROFS || errno == EPERM)) {
+    // Fall back to a private read-only view; we can still inspect the object.
+    mf->writable = 0;
+    mf->fd = open(file, O_RDONLY);
+    trace_io(0, 0, 1);
+  }
+  if (mf->fd == -1) {
     perror("open");
-    exit(1);
-  };
-  off_t rc = lseek(fd, offset, SEEK_SET);
-  if (rc == (off_t)(-1)) {
-    perror("lseek");
-    close(fd);
-    exit(1);
+    return -1;
   }
-  readall(fd, addr, size);
-  close(fd);
+  if (fstat(mf->fd, &st) == -1) {
+    perror("fstat");
+    close(mf->fd);
+    return -1;
+  }
+  mf->size = st.st_size;
+  mf->mode = st.st_mode;
+  if (mf->size == 0) {
+    fprintf(stderr, "map_file: %s is empty\n", file);
+    close(mf->fd);
+    return -1;
+  }
+  if (buffered)
+    return read_buffered(mf);
+  if (mf->writable)
+    mf->addr = mmap(NULL, mf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    mf->fd, 0);
+  else
+    mf->addr = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, mf->fd, 0);
+  if (mf->addr == MAP_FAILED) {
+    perror("mmap");
+    close(mf->fd);
+    return -1;
+  }
+  // open, fstat and mmap; the whole object counts as read
+  trace_io(mf->size, 0, 3);
+  return 0;
+}
+
+// An image of 'size' bytes at 'addr' that is not backed by a file.  With
+// 'borrow' the bytes are edited where they are (the caller's mapping has to
+// be writable and private), otherwise they are copied first.  The image
+// becomes a copy of its own the first time it is resized.
+int map_memory(char *path, char *addr, size_t size, MappedFile *mf,
+               int borrow) {
+  memset(mf, 0, sizeof(*mf));
+  mf->path = path;
+  mf->fd = -1;
+  mf->size = size;
+  mf->writable = 1;
+  mf->mode = 0644;
+  mf->borrowed = borrow;
+  if (borrow) {
+    mf->addr = addr;
+    return 0;
+  }
+  mf->addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  trace_io(0, 0, 1);
+  if (mf->addr == MAP_FAILED) {
+    perror("mmap");
+    mf->addr = NULL;
+    return -1;
+  }
+  memcpy(mf->addr, addr, size);
+  return 0;
+}
+
+int resize_mapped_file(MappedFile *mf, size_t size) {
+  if (!mf->writable) {
+    fprintf(stderr, "resize_mapped_file: %s is mapped read-only\n", mf->path);
+    return -1;
+  }
+  if (mf->borrowed) {
+    char *copy = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    trace_io(0, 0, 1);
+    if (copy == MAP_FAILED) {
+      perror("mmap");
+      return -1;
+    }
+    memcpy(copy, mf->addr, mf->size < size ? mf->size : size);
+    mf->addr = copy;
+    mf->size = size;
+    mf->borrowed = 0;
+    return 0;
+  }
+  // A buffered file gets its new size when it is flushed
+  if (mf->fd != -1 && !mf->buffered && ftruncate(mf->fd, size) == -1) {
+    perror("ftruncate");
+    return -1;
+  }
+  char *addr = mremap(mf->addr, mf->size, size, MREMAP_MAYMOVE);
+  trace_io(0, 0, mf->fd != -1 && !mf->buffered ? 2 : 1);
+  if (addr == MAP_FAILED) {
+    perror("mremap");
+    return -1;
+  }
+  mf->addr = addr;
+  mf->size = size;
+  return 0;
+}
+
+// Note that [addr, addr + len) of a buffered image has been modified
+void mark_dirty(MappedFile *mf, const void *addr, size_t len) {
+  if (!mf->buffered || !mf->writable || len == 0)
+    return;
+  if (mf->dirtyCount == mf->dirtyCap) {
+    int cap = mf->dirtyCap ? mf->dirtyCap * 2 : 64;
+    Extent *grown = realloc(mf->dirty, cap * sizeof(Extent));
+    if (grown == NULL) {
+      // The change cannot be tracked: fail the flush instead
+      perror("mark_dirty");
+      mf->lost = 1;
+      return;
+    }
+    mf->dirty = grown;
+    mf->dirtyCap = cap;
+  }
+  mf->dirty[mf->dirtyCount].off = (const char *)addr - mf->addr;
+  mf->dirty[mf->dirtyCount].len = len;
+  mf->dirtyCount++;
+}
+
+static int compare_extents(const void *a, const void *b) {
+  const Extent *x = a, *y = b;
+  return x->off < y->off ? -1 : x->off > y->off;
+}
+
+// pwritev() all of [off, off + len) of the image
+static int write_buffered(MappedFile *mf, off_t off, size_t len) {
+  struct iovec iov[IO_IOVECS];
+  while (len > 0) {
+    int n = fill_iovecs(iov, mf->addr + off, len);
+    ssize_t rc = pwritev(mf->fd, iov, n, off);
+    trace_io(0, rc > 0 ? rc : 0, 1);
+    if (rc <= 0) {
+      perror("pwritev");
+      return -1;
+    }
+    mf->flushCalls++;
+    off += rc;
+    len -= rc;
+  }
+  return 0;
+}
+
+// Write the dirty ranges of a buffered image back: sorted, with ranges
+// that overlap or lie within FLUSH_GAP of each other written by one call
+int flush_mapped_file(MappedFile *mf) {
+  mf->flushedExtents = mf->flushCalls = 0;
+  if (!mf->buffered || !mf->writable || mf->addr == NULL)
+    return 0;
+  qsort(mf->dirty, mf->dirtyCount, sizeof(Extent), compare_extents);
+  off_t written_end = 0;
+  int extents = mf->dirtyCount, ranges = 0;
+  for (int i = 0; i < mf->dirtyCount;) {
+    off_t start = mf->dirty[i].off;
+    off_t end = start + mf->dirty[i].len;
+    for (++i; i < mf->dirtyCount && mf->dirty[i].off <= end + FLUSH_GAP;
+         ++i)
+      if (mf->dirty[i].off + (off_t)mf->dirty[i].len > end)
+        end = mf->dirty[i].off + mf->dirty[i].len;
+    if (end > (off_t)mf->size)
+      end = mf->size;
+    if (start < end)
+      mf->dirty[ranges++] = (Extent){start, end - start};
+    written_end = end;
+  }
+  if (mf->lost) {
+    fprintf(stderr, "flush_mapped_file: changes to %s were lost\n", mf->path);
+    return -1;
+  }
+  // The merged ranges go out in one batch through the ring if the image
+  // came from there, otherwise with a pwritev call or more each
+  if (mf->ring) {
+    if (ioring_write(mf, mf->dirty, ranges, &mf->flushCalls) == -1)
+      return -1;
+  } else {
+    for (int i = 0; i < ranges; ++i)
+      if (write_buffered(mf, mf->dirty[i].off, mf->dirty[i].len) == -1)
+        return -1;
+  }
+  if (mf->size != mf->disk_size && written_end != (off_t)mf->size) {
+    trace_io(0, 0, 1);
+    if (ftruncate(mf->fd, mf->size) == -1) {
+      perror("ftruncate");
+      return -1;
+    }
+  }
+  mf->disk_size = mf->size;
+  mf->flushedExtents = extents;
+  mf->dirtyCount = 0;
+  return 0;
+}
+
+void unmap_file(MappedFile *mf) {
+  if (mf->addr == NULL)
+    return;
+  if (mf->buffered) {
+    if ((mf->dirtyCount || mf->size != mf->disk_size) &&
+        flush_mapped_file(mf) == -1)
+      fprintf(stderr, "unmap_file: changes to %s were not written\n", mf->path);
+    munmap(mf->addr, mf->size);
+    close(mf->fd);
+    trace_io(0, 0, 2);
+    free(mf->dirty);
+    mf->dirty = NULL;
+    mf->dirtyCount = mf->dirtyCap = 0;
+    mf->addr = NULL;
+    mf->fd = -1;
+    return;
+  }
+  if (mf->fd == -1) {
+    if (!mf->borrowed) {
+      munmap(mf->addr, mf->size);
+      trace_io(0, 0, 1);
+    }
+    mf->addr = NULL;
+    return;
+  }
+  // One writeback request per object instead of one write() per table.
+  if (mf->writable && msync(mf->addr, mf->size, MS_ASYNC) == -1)
+    perror("msync");
+  munmap(mf->addr, mf->size);
+  close(mf->fd);
+  trace_io(0, 0, mf->writable ? 3 : 2);
+  mf->addr = NULL;
+  mf->fd = -1;
 }
-void write_metadata(char *file, char *addr, size_t size, off_t offset) {
-  int fd = open(file, O_WRONLY);
+
+// Copy len bytes between two files without bringing them into userspace:
+// share the blocks with FICLONERANGE where the filesystem can, fall back to
+// copy_file_range, and only then to a plain read/write loop.
+int clone_range(int in_fd, off_t in_off, int out_fd, off_t out_off,
+                size_t len) {
+  struct stat st;
+  trace_io(0, 0, 1);
+  if (fstat(out_fd, &st) == 0 && st.st_blksize > 0 &&
+      in_off % st.st_blksize == 0 && out_off % st.st_blksize == 0 &&
+      len >= st.st_blksize) {
+    size_t clone_len = len - len % st.st_blksize;
+    struct file_clone_range fcr = {.src_fd = in_fd,
+                                   .src_offset = in_off,
+                                   .src_length = clone_len,
+                                   .dest_offset = out_off};
+    trace_io(0, 0, 1);
+    if (ioctl(out_fd, FICLONERANGE, &fcr) == 0) {
+      trace_io(0, clone_len, 0);
+      in_off += clone_len;
+      out_off += clone_len;
+      len -= clone_len;
+    }
+  }
+
+  while (len > 0) {
+    ssize_t rc = copy_file_range(in_fd, &in_off, out_fd, &out_off, len, 0);
+    trace_io(rc > 0 ? rc : 0, rc > 0 ? rc : 0, 1);
+    if (rc > 0) {
+      len -= rc;
+      continue;
+    }
+    if (rc == 0) {
+      fprintf(stderr, "clone_range: end of file\n");
+      return -1;
+    }
+    if (errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+        errno != EOPNOTSUPP) {
+      perror("copy_file_range");
+      return -1;
+    }
+    // Bounce through a buffer
+    char buf[65536];
+    while (len > 0) {
+      size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+      ssize_t got = pread(in_fd, buf, chunk, in_off);
+      if (got <= 0 || pwrite(out_fd, buf, got, out_off) != got) {
+        perror("clone_range");
+        return -1;
+      }
+      trace_io(got, got, 2);
+      in_off += got;
+      out_off += got;
+      len -= got;
+    }
+  }
+  return 0;
+}
+
+// Create 'file' as a copy of 'src' in which everything from 'split' on has
+// been displaced by 'shift' bytes; the gap reads back as zeros.  With
+// 'exclusive' the file must not exist yet.
+int write_shifted_copy(MappedFile *src, char *file, off_t split,
+                       size_t shift, int exclusive) {
+  struct stat st, dst_st;
+  int fd = open(file, O_RDWR | O_CREAT | (exclusive ? O_EXCL : 0),
+                src->mode & 0777);
+  trace_io(0, 0, 4); // open, fstat twice and ftruncate or close
   if (fd == -1) {
     perror("open");
-    exit(1);
-  };
-  off_t rc = lseek(fd, offset, SEEK_SET);
-  if (rc == (off_t)(-1)) {
-    perror("lseek");
+    return -1;
+  }
+  if (fstat(src->fd, &st) == -1 || fstat(fd, &dst_st) == -1) {
+    perror("fstat");
+    close(fd);
+    return -1;
+  }
+  if (st.st_dev == dst_st.st_dev && st.st_ino == dst_st.st_ino) {
+    fprintf(stderr, "*** ***Output %s is the input object itself.\n", file);
     close(fd);
-    exit(1);
+    return -1;
   }
-  writeall(fd, addr, size);
+  if (ftruncate(fd, 0) == -1) {
+    perror("ftruncate");
+    close(fd);
+    return -1;
+  }
+
+  int rc = 0;
+  trace_io(0, 0, shift == 0 ? 2 : 1); // FICLONE and close
+  if (shift == 0 && ioctl(fd, FICLONE, src->fd) == 0) {
+    trace_io(0, src->size, 0);
+    close(fd);
+    return 0;
+  }
+  if (clone_range(src->fd, 0, fd, 0, split) == -1 ||
+      clone_range(src->fd, split, fd, split + shift, src->size - split) ==
+          -1 ||
+      ftruncate(fd, src->size + shift) == -1)
+    rc = -1;
+  trace_io(0, 0, 1);
   close(fd);
+  if (rc == -1)
+    unlink(file);
+  return rc;
+}
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+// arena_reset() gives back anything above this instead of keeping it
+#define ARENA_KEEP_MAX (16 * 1024 * 1024)
+
+void *arena_alloc(Arena *arena, size_t size) {
+  ArenaBlock *block = arena->head;
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (block == NULL || block->size - block->used < size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(ArenaBlock) + block_size);
+    if (block == NULL) {
+      perror("arena_alloc");
+      return NULL;
+    }
+    block->size = block_size;
+    block->used = 0;
+    block->next = arena->head;
+    arena->head = block;
+  }
+  void *ptr = block->data + block->used;
+  block->used += size;
+  return ptr;
+}
+
+void *arena_calloc(Arena *arena, size_t count, size_t size) {
+  void *ptr = arena_alloc(arena, count * size);
+  if (ptr != NULL)
+    memset(ptr, 0, count * size);
+  return ptr;
+}
+
+// Resize the allocation 'ptr'; it is extended in place when it was the last
+// thing allocated from the arena and there is room, copied otherwise.
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+  ArenaBlock *block = arena->head;
+  size_t old_aligned = (old_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  size_t new_aligned = (new_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (ptr != NULL && block != NULL &&
+      (char *)ptr + old_aligned == block->data + block->used &&
+      block->size - block->used >= new_aligned - old_aligned) {
+    block->used += new_aligned - old_aligned;
+    return ptr;
+  }
+  void *grown = arena_alloc(arena, new_size);
+  if (grown != NULL && ptr != NULL)
+    memcpy(grown, ptr, old_size);
+  return grown;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t len) {
+  char *copy = arena_alloc(arena, len + 1);
+  if (copy != NULL) {
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+  return arena_strndup(arena, str, strlen(str));
+}
+
+// Forget everything allocated from the arena.  What it had grown to is
+// kept as one block, so an arena reset between objects of similar size
+// stops calling malloc after the first one.
+void arena_reset(Arena *arena) {
+  size_t total = 0;
+  int blocks = 0;
+  for (ArenaBlock *block = arena->head; block != NULL; block = block->next) {
+    total += block->size;
+    blocks++;
+  }
+  if (blocks == 1 && total <= ARENA_KEEP_MAX) {
+    arena->head->used = 0;
+    return;
+  }
+  arena_free(arena);
+  if (total == 0 || total > ARENA_KEEP_MAX)
+    return;
+  ArenaBlock *block = malloc(sizeof(ArenaBlock) + total);
+  if (block == NULL)
+    return; // the next arena_alloc() tries again
+  block->size = total;
+  block->used = 0;
+  block->next = NULL;
+  arena->head = block;
+}
+
+void arena_free(Arena *arena) {
+  while (arena->head != NULL) {
+    ArenaBlock *next = arena->head->next;
+    free(arena->head);
+    arena->head = next;
+  }
+}
+
+// 'str' as a JSON string literal
+void json_string(FILE *fp, const char *str) {
+  fputc('"', fp);
+  for (; *str; ++str) {
+    unsigned char c = *str;
+    if (c == '"' || c == '\\')
+      fprintf(fp, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(fp, "\\u%04x", c);
+    else
+      fputc(c, fp);
+  }
+  fputc('"', fp);
+}
+
+int strlist_push(Arena *arena, StrList *list, const char *item) {
+  if (list->count == list->cap) {
+    int cap = list->cap ? list->cap * 2 : 16;
+    char **items = arena_grow(arena, list->items, list->cap * sizeof(char *),
+                              cap * sizeof(char *));
+    if (items == NULL)
+      return -1;
+    list->items = items;
+    list->cap = cap;
+  }
+  list->items[list->count] = arena_strdup(arena, item);
+  if (list->items[list->count] == NULL)
+    return -1;
+  list->count++;
+  return 0;
 }
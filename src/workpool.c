@@ -0,0 +1,167 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/workpool.h"
+
+// Each worker owns a deque of items.  The owner takes from the front, idle
+// workers steal from the back of someone else's deque.
+typedef struct {
+  pthread_mutex_t lock;
+  int *items;
+  int head;
+  int tail;
+} WorkDeque;
+
+typedef struct {
+  int nthreads;
+  WorkDeque *deques;
+  workpool_fn fn;
+  void *arg;
+  int stop; // emit asked to stop: start no more items
+
+  pthread_mutex_t done_lock;
+  pthread_cond_t done_cond;
+  char *done;
+} WorkPool;
+
+typedef struct {
+  WorkPool *pool;
+  int self;
+} Worker;
+
+static __thread int worker_index = 0;
+
+// Index (0..nthreads-1) of the worker calling; 0 outside of a pool
+int workpool_worker(void) {
+  return worker_index;
+}
+
+static int take_front(WorkDeque *dq) {
+  int item = -1;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->head < dq->tail)
+    item = dq->items[dq->head++];
+  pthread_mutex_unlock(&dq->lock);
+  return item;
+}
+
+static int steal_back(WorkDeque *dq) {
+  int item = -1;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->head < dq->tail)
+    item = dq->items[--dq->tail];
+  pthread_mutex_unlock(&dq->lock);
+  return item;
+}
+
+static int next_item(WorkPool *pool, int self) {
+  int item = take_front(&pool->deques[self]);
+  for (int i = 1; item == -1 && i < pool->nthreads; ++i)
+    item = steal_back(&pool->deques[(self + i) % pool->nthreads]);
+  return item;
+}
+
+static void *worker_main(void *p) {
+  Worker *w = p;
+  WorkPool *pool = w->pool;
+  int item;
+
+  worker_index = w->self;
+  while (!__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE) &&
+         (item = next_item(pool, w->self)) != -1) {
+    pool->fn(item, pool->arg);
+    pthread_mutex_lock(&pool->done_lock);
+    pool->done[item] = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->done_lock);
+  }
+  return NULL;
+}
+
+int workpool_run(int nthreads, int nitems, workpool_fn fn,
+                 workpool_emit_fn emit, void *arg) {
+  if (nthreads > nitems)
+    nthreads = nitems;
+  if (nthreads <= 1) {
+    for (int i = 0; i < nitems; ++i) {
+      fn(i, arg);
+      if (emit(i, arg))
+        return 1;
+    }
+    return 0;
+  }
+
+  WorkPool pool = {.nthreads = nthreads, .fn = fn, .arg = arg};
+  pool.deques = calloc(nthreads, sizeof(WorkDeque));
+  pool.done = calloc(nitems, 1);
+  pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+  Worker *workers = calloc(nthreads, sizeof(Worker));
+  int *items = malloc(nitems * sizeof(int));
+  if (!pool.deques || !pool.done || !threads || !workers || !items) {
+    perror("workpool_run");
+    free(items);
+    free(workers);
+    free(threads);
+    free(pool.done);
+    free(pool.deques);
+    return -1;
+  }
+  pthread_mutex_init(&pool.done_lock, NULL);
+  pthread_cond_init(&pool.done_cond, NULL);
+
+  // Deal items round-robin so the earliest items are worked on first and
+  // in-order emission can start right away.
+  int pos = 0;
+  for (int t = 0; t < nthreads; ++t) {
+    WorkDeque *dq = &pool.deques[t];
+    pthread_mutex_init(&dq->lock, NULL);
+    dq->items = items + pos;
+    for (int i = t; i < nitems; i += nthreads)
+      items[pos++] = i;
+    dq->tail = (items + pos) - dq->items;
+  }
+
+  // Workers steal from every deque, so the ones that did start get through
+  // all items; without any, the calling thread does the work
+  int started = 0;
+  for (int t = 0; t < nthreads; ++t) {
+    workers[t].pool = &pool;
+    workers[t].self = t;
+    if (pthread_create(&threads[t], NULL, worker_main, &workers[t]) != 0) {
+      perror("pthread_create");
+      break;
+    }
+    started++;
+  }
+  if (started == 0)
+    worker_main(&workers[0]);
+
+  // Once emit asks to stop, the workers finish what they are doing and
+  // leave; they are joined before returning, so nothing is left running
+  int stopped = 0;
+  for (int i = 0; i < nitems && !stopped; ++i) {
+    pthread_mutex_lock(&pool.done_lock);
+    while (!pool.done[i])
+      pthread_cond_wait(&pool.done_cond, &pool.done_lock);
+    pthread_mutex_unlock(&pool.done_lock);
+    if (emit(i, arg)) {
+      __atomic_store_n(&pool.stop, 1, __ATOMIC_RELEASE);
+      stopped = 1;
+    }
+  }
+
+  for (int t = 0; t < nthreads; ++t) {
+    if (t < started)
+      pthread_join(threads[t], NULL);
+    pthread_mutex_destroy(&pool.deques[t].lock);
+  }
+  pthread_mutex_destroy(&pool.done_lock);
+  pthread_cond_destroy(&pool.done_cond);
+  free(items);
+  free(workers);
+  free(threads);
+  free(pool.done);
+  free(pool.deques);
+  return stopped;
+}